@@ -1,6 +1,7 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
+ *           aarch64, and Alpha boxes, and CLOCK_MONOTONIC_RAW on
+ *           anything else.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -10,6 +11,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/times.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
 
@@ -133,30 +137,82 @@ double get_counter()
     return result;
 }
 
+#elif defined(__x86_64__) || defined(__aarch64__)
+
+/****************************************************************
+ * x86-64 and aarch64 versions of start_counter() and get_counter().
+ * Both read the same 64-bit counter as read_tsc(), but fenced so
+ * the reads can't drift into the code being timed: on x86-64,
+ * lfence keeps rdtsc from starting before earlier instructions
+ * finish, and rdtscp waits for them before reading the counter (the
+ * lfence after it keeps later ones from starting early); on aarch64,
+ * isb does both jobs for a read of cntvct_el0.
+ ***************************************************************/
+
+static unsigned long long cyc_start = 0;
+
+/* Read the counter after everything before it is done */
+static inline unsigned long long counter_begin(void)
+{
+#if defined(__x86_64__)
+    unsigned lo, hi;
+
+    asm volatile("lfence; rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    unsigned long long t;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (t) : : "memory");
+    return t;
+#endif
+}
+
+/* Read the counter after everything before it is done, and before
+   anything after it starts */
+static inline unsigned long long counter_end(void)
+{
+#if defined(__x86_64__)
+    unsigned lo, hi, aux;
+
+    asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi), "=c" (aux) 
+		 : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    unsigned long long t;
+
+    asm volatile("isb; mrs %0, cntvct_el0; isb" : "=r" (t) : : "memory");
+    return t;
+#endif
+}
+
+void start_counter()
+{
+    cyc_start = counter_begin();
+}
+
+double get_counter()
+{
+    return (double)(counter_end() - cyc_start);
+}
+
 #else
 
 /****************************************************************
- * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
+ * All the other platforms, for which we don't have a cycle counter
+ * routine: count nanoseconds of CLOCK_MONOTONIC_RAW instead, which
+ * a 1000 MHz "clock rate" turns back into seconds.
  ***************************************************************/
 
+static unsigned long long cyc_start = 0;
+
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    cyc_start = read_tsc();
 }
 
 double get_counter() 
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return (double)(read_tsc() - cyc_start);
 }
 #endif
 
@@ -195,10 +251,21 @@ double mhz_full(int verbose, int sleeptime)
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* 
+ * Version that doesn't sleep where the counter is read_tsc (whose
+ * rate tsc_mhz knows), and uses a default sleeptime elsewhere 
+ */
 double mhz(int verbose)
 {
+#if defined(__alpha)
     return mhz_full(verbose, 2);
+#else
+    double rate = tsc_mhz();
+
+    if (verbose) 
+	printf("Processor clock rate ~= %.1f MHz\n", rate);
+    return rate;
+#endif
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -277,3 +344,89 @@ double get_comp_counter()
     return ctime;
 }
 
+
+/** Timestamps cheap enough to time a single call */
+
+#define TSC_CALIBRATE_NS 20000000  /* calibrate read_tsc over 20 ms */
+#define TSC_OVHD_TRIES 10000
+
+/* Return the nanoseconds of CLOCK_MONOTONIC_RAW */
+static double monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Count read_tsc ticks while CLOCK_MONOTONIC_RAW advances
+   TSC_CALIBRATE_NS nanoseconds */
+static double tsc_calibrate(void)
+{
+    double start, now;
+    unsigned long long t0, t1;
+
+    start = monotonic_ns();
+    t0 = read_tsc();
+    do {
+	now = monotonic_ns();
+	t1 = read_tsc();
+    } while (now - start < TSC_CALIBRATE_NS);
+    return (t1 - t0) * 1e3 / (now - start);
+}
+
+/* 
+ * tsc_mhz - Return the rate of read_tsc. The aarch64 generic timer
+ * says what it is. An x86 TSC that is invariant (ticks at the same
+ * rate whatever the core's clock and power state) may say so too in
+ * cpuid leaf 0x15; otherwise, and if it isn't invariant (when its
+ * rate is only a guess), we calibrate it. Without a counter we count
+ * nanoseconds.
+ */
+double tsc_mhz(void)
+{
+    static double rate = 0.0;
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+#endif
+
+    if (rate > 0.0)
+	return rate;
+#if defined(__aarch64__)
+    {
+	unsigned long long freq;
+
+	asm volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+	rate = freq / 1e6;
+    }
+#elif defined(__i386__) || defined(__x86_64__)
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || 
+	!(edx & (1 << 8)))
+	fprintf(stderr, "Warning: the TSC is not invariant, so cycle "
+		"counts may not be proportional to time\n");
+    else if (__get_cpuid_count(0x15, 0, &eax, &ebx, &ecx, &edx) && 
+	     eax != 0 && ebx != 0 && ecx != 0)
+	rate = (double)ecx * ebx / eax / 1e6;
+    if (rate == 0.0)
+	rate = tsc_calibrate();
+#else
+    rate = 1000.0;
+#endif
+    return rate;
+}
+
+/* The overhead of read_tsc is the fewest ticks we ever see between
+   two back-to-back reads - anything more is noise, not the timer */
+unsigned long long tsc_ovhd(void)
+{
+    unsigned long long t0, t1, best = ~0ULL;
+    int i;
+
+    for (i = 0; i < TSC_OVHD_TRIES; i++) {
+	t0 = read_tsc();
+	t1 = read_tsc();
+	if (t1 - t0 < best)
+	    best = t1 - t0;
+    }
+    return best;
+}
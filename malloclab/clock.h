@@ -1,5 +1,11 @@
 /* Routines for using cycle counter */
 
+#include <time.h>
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC  /* not Linux */
+#endif
+
 /* Start the counter */
 void start_counter();
 
@@ -20,3 +26,31 @@ double mhz_full(int verbose, int sleeptime);
 void start_comp_counter();
 
 double get_comp_counter();
+
+/** Timestamps cheap enough to time a single call */
+
+/* Read the time stamp counter (cntvct_el0 on aarch64, nanoseconds of
+   CLOCK_MONOTONIC_RAW on machines without either). Not fenced, so
+   it's cheap, but can be off by the few instructions around it */
+static inline unsigned long long read_tsc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    unsigned long long t;
+
+    asm volatile("mrs %0, cntvct_el0" : "=r" (t));
+    return t;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Estimate how many read_tsc ticks there are in a microsecond */
+double tsc_mhz(void);
+
+/* Measure the overhead of read_tsc, in ticks */
+unsigned long long tsc_ovhd(void);
@@ -51,20 +51,36 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (either 8 or 16). Use 16 for payloads
+ * that hold SSE/AVX data, e.g. make CFLAGS="-Wall -O2 -DALIGNMENT=16"
  */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8  
+#endif
+#if ALIGNMENT != 8 && ALIGNMENT != 16
+#error "ALIGNMENT must be 8 or 16"
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. memlib only reserves this much address
+ * space up front and commits pages as the heap grows, so it can be far
+ * bigger than the heap ever gets (e.g. -DMAX_HEAP='(64UL<<30)')
  */
-#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#ifndef MAX_HEAP
+#define MAX_HEAP (sizeof(void *) == 8 ? (size_t)4 << 30 : (size_t)256 << 20) /* 4 GB, 256 MB on 32-bit */
+#endif
+
+/*
+ * Maximum number of arenas - the heap is split into this many regions
+ * at most, one per arena
+ */
+#define MAX_ARENAS 64
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* cycle counter w/K-best scheme (see clock.c) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
 #endif /* __CONFIG_H */
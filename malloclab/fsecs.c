@@ -26,7 +26,14 @@ void init_fsecs(void)
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
     set_fcyc_clear_cache(1);
+#if defined(__i386__) || defined(__alpha)
     set_fcyc_compensate(1);
+#else
+    /* Calibrating the compensation watches 100 timer interrupts (about
+       2 secs), and the K-best scheme already drops the samples that
+       one landed in */
+    set_fcyc_compensate(0);
+#endif
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
     Mhz = mhz(verbose > 0);
@@ -0,0 +1,93 @@
+/*
+ * hist.c - log-bucketed latency histograms (see hist.h)
+ */
+#include <string.h>
+#include "hist.h"
+
+/*
+ * hist_index - Return the bucket of value v. Values below HIST_SUB
+ *    are their own bucket. Otherwise, with msb the index of the highest
+ *    set bit of v, the top HIST_SUB_BITS+1 bits of v pick one of the
+ *    HIST_SUB buckets of the power of two msb is in.
+ */
+static int hist_index(unsigned long long v)
+{
+    int shift;
+
+    if (v < HIST_SUB)
+	return (int)v;
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) - HIST_SUB);
+}
+
+/*
+ * hist_value - Return the middle of the range of values that land in
+ *    bucket i (the inverse of hist_index)
+ */
+static unsigned long long hist_value(int i)
+{
+    int shift;
+
+    if (i < HIST_SUB)
+	return (unsigned long long)i;
+    shift = (i >> HIST_SUB_BITS) - 1;
+    return (((unsigned long long)(i & (HIST_SUB - 1)) + HIST_SUB) << shift) +
+	((1ULL << shift) >> 1);
+}
+
+/*
+ * hist_reset - Empty histogram h
+ */
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/*
+ * hist_add - Count value v in h
+ */
+void hist_add(hist_t *h, unsigned long long v)
+{
+    h->count[hist_index(v)]++;
+    h->n++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/*
+ * hist_merge - Add every value counted in src to dst
+ */
+void hist_merge(hist_t *dst, const hist_t *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+	dst->count[i] += src->count[i];
+    dst->n += src->n;
+    if (src->max > dst->max)
+	dst->max = src->max;
+}
+
+/*
+ * hist_percentile - Return the value below which fraction p of the
+ *    values in h lie (0 if h is empty). This is the middle of its
+ *    bucket, but never more than the largest value.
+ */
+unsigned long long hist_percentile(const hist_t *h, double p)
+{
+    unsigned long long rank, seen = 0, v;
+    int i;
+
+    if (h->n == 0)
+	return 0;
+    rank = (unsigned long long)(p * h->n);
+    if (rank >= h->n)
+	rank = h->n - 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->count[i];
+	if (seen > rank)
+	    break;
+    }
+    v = hist_value(i);
+    return v < h->max ? v : h->max;
+}
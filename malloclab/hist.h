@@ -0,0 +1,32 @@
+/*
+ * hist.h - log-bucketed latency histograms
+ *
+ * Values (e.g. timer ticks) are counted in buckets whose width grows
+ * with the value, like an HDR histogram: below 2^HIST_SUB_BITS every
+ * value has a bucket of its own, and every power of two above that is
+ * split into 2^HIST_SUB_BITS equal buckets. So any percentile is
+ * within 1/2^HIST_SUB_BITS (about 3%) of the real value, whatever its
+ * magnitude, and a histogram takes the same space for any range.
+ */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    unsigned long long count[HIST_BUCKETS]; /* values in each bucket */
+    unsigned long long n;                   /* values in all of them */
+    unsigned long long max;                 /* exact largest value */
+} hist_t;
+
+/* Empty histogram h */
+void hist_reset(hist_t *h);
+
+/* Count value v in h */
+void hist_add(hist_t *h, unsigned long long v);
+
+/* Add every value counted in src to dst */
+void hist_merge(hist_t *dst, const hist_t *src);
+
+/* Return the value below which fraction p (0 to 1) of the values in h lie */
+unsigned long long hist_percentile(const hist_t *h, double p);
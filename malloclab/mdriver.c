@@ -15,10 +15,17 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "hist.h"
+#include "perfctr.h"
+#include "trace.h"
 #include "config.h"
 
 /**********************
@@ -29,39 +36,32 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MT_RUNS        3 /* multithreaded replays are timed this many times */
+#define RANGE_CHUNK 4096 /* range records are malloc'ed this many at a time */
+#define LAT_RUNS       5 /* -L times every request of this many replays */
+#define RSS_EVERY   1024 /* the valid replay looks at the heap's RSS this often */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges form a treap
+ * ordered by lo: a binary search tree that is also a heap on prio, a
+ * hash of lo, which keeps it balanced (on average) whatever order the
+ * blocks come in.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned prio;         /* treap priority - never lower than a child's */
+    struct range_t *left;  /* ranges with lower lo (free list link in the pool) */
+    struct range_t *right; /* ranges with higher lo */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
-
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,6 +72,23 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Holds the params to one thread of the multithreaded replay (-p) */
+typedef struct {
+    trace_t *trace;            /* the trace this thread replays */
+    pthread_barrier_t *start;  /* lets every thread start replaying at once */
+    int tid;                   /* the thread whose requests this one makes... */
+    int *done;                 /* ...once done[index] requests on their block are */
+} mt_arg_t;
+
+/* One sample of the state of the mm heap, taken every -u requests */
+typedef struct {
+    int64_t op;          /* requests replayed when it was taken */
+    size_t payload;      /* payload bytes of the blocks allocated then */
+    size_t heap;         /* heap size in bytes (all regions) */
+    size_t free;         /* bytes in free blocks... */
+    size_t largest_free; /* ...and in the biggest of them */
+} sample_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,17 +98,42 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak_rss; /* most heap bytes resident in memory at once... */
+    size_t final_rss;/* ...and at the end of the trace (always 0 for libc) */
+    hist_t *lat;     /* latencies of each type of request (only with -L) */
+    int counted;     /* did we count hardware events (-P)... */
+    double perf[PERF_NUM]; /* ...how many of each in one run (-1 if unknown) */
+    mm_stats_t counters; /* the allocator's own counters at the end of the trace */
+    sample_t *samples;   /* the heap every -u requests of the util replay... */
+    int64_t num_samples; /* ...this many times (0 without -u) */
+    int num_threads;     /* threads that make the requests of the trace */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Holds the params of the threads that check traces in parallel (-j) */
+typedef struct {
+    char **tracefiles;         /* the traces to check... */
+    int num_tracefiles;
+    int next;                  /* ...and the next one nobody has taken yet */
+    int stream;                /* stream the traces (-s) */
+    int narenas;               /* arenas of each thread's heap (-n)... */
+    int arena_policy;          /* ...and how threads pick one (-C) */
+    stats_t *stats;            /* where the results for each trace go */
+} check_arg_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int64_t sample_every = 0; /* sample the heap every this many requests (-u) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* Unused range records, linked through their left pointers (a pool per
+   thread, since -j checks several traces at once) */
+static __thread range_t *free_ranges = NULL;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -105,15 +147,16 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
+/* these functions manipulate range trees */
+static range_t *new_range(void);
+static range_t *insert_range(range_t *t, range_t *p);
+static range_t *join_ranges(range_t *l, range_t *r);
+static int add_range(range_t **ranges, char *lo, int size, size_t align,
+		     int tracenum, int64_t opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -121,15 +164,37 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 stats_t *stats);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats);
+static void sample_heap(stats_t *stats, int64_t op, size_t payload);
 static void eval_mm_speed(void *ptr);
+static void replay_mm(trace_t *trace);
+static void eval_mm_latency(trace_t *trace, hist_t *lat);
+
+/* Routines for evaluating the throughput of mm.c on several threads at once */
+static void *mt_replay(void *ptr);
+static double eval_mm_mt(trace_t **traces, int nthreads, int parallel);
+static void eval_mm_scaling(char **tracefiles, int num_tracefiles, int nthreads,
+			    int stream);
+static void *mt_handoff(void *ptr);
+static double eval_mm_handoff(trace_t *trace);
+static void eval_mm_handoffs(char **tracefiles, int num_tracefiles,
+			     stats_t *stats);
+static void *check_worker(void *ptr);
+static void eval_mm_checks(check_arg_t *arg, int njobs);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printperf(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void write_samples(char *path, char **tracefiles, int n,
+			  stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(int tracenum, int64_t opnum, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -150,6 +215,15 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int nthreads = 0;    /* If set, also replay on this many threads (-p) */
+    int narenas = 1;     /* Number of arenas in the mm heap (-n) */
+    int arena_policy = MM_ARENA_RR; /* How threads pick an arena (-C) */
+    int latency = 0;     /* If set, time every request of the mm package (-L) */
+    int perf = 0;        /* If set, count hardware events of the mm package (-P) */
+    int stream = 0;      /* If set, stream every trace rather than read it (-s) */
+    int njobs = 1;       /* Check this many traces at once (-j) */
+    char *sample_file = "util.csv"; /* where the -u samples go (-o) */
+    check_arg_t checks;  /* what the threads that do that need to know */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +232,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:p:n:j:u:o:hvVgalsCLP")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +258,47 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 's': /* Stream the traces, however short */
+            stream = 1;
+            break;
+        case 'p': /* Replay the traces concurrently on this many threads */
+            nthreads = atoi(optarg);
+            if (nthreads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'j': /* Check this many traces at once */
+            njobs = atoi(optarg);
+            if (njobs < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'u': /* Sample the heap every this many requests */
+            sample_every = atoll(optarg);
+            if (sample_every < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'o': /* File the samples go to */
+            sample_file = optarg;
+            break;
+        case 'n': /* Split the mm heap into this many arenas */
+            narenas = atoi(optarg);
+            break;
+        case 'C': /* Bind threads to arenas by CPU rather than round robin */
+            arena_policy = MM_ARENA_CPU;
+            break;
+        case 'L': /* Print the latency distribution of each type of request */
+            latency = 1;
+            break;
+        case 'P': /* Count hardware events (cache misses etc.) per trace */
+            perf = 1;
+            if (verbose == 0)
+                verbose = 1; /* they are printed with the per-trace results */
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -238,6 +353,12 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Open the hardware performance counters, if we can */
+    if (perf && perf_init(verbose > 1) == 0) {
+	printf("No performance counters available here, ignoring -P\n");
+	perf = 0;
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -252,7 +373,7 @@ int main(int argc, char **argv)
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
+	    trace = read_trace(tracedir, tracefiles[i], stream);
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
@@ -286,23 +407,71 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (mm_arenas(narenas, arena_policy) < 0) {
+	printf("ERROR: -n wants between 1 and %d arenas\n", MAX_ARENAS);
+	exit(1);
+    }
+
+    /* 
+     * With -j, check every trace for correctness and utilization first,
+     * njobs at a time, each in a heap of its own. Only the timing runs
+     * below are left for one trace after another.
+     */
+    if (njobs > 1) {
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness and efficiency "
+		   "on %d threads\n", njobs);
+	checks.tracefiles = tracefiles;
+	checks.num_tracefiles = num_tracefiles;
+	checks.next = 0;
+	checks.stream = stream;
+	checks.narenas = narenas;
+	checks.arena_policy = arena_policy;
+	checks.stats = mm_stats;
+	eval_mm_checks(&checks, njobs);
+    }
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
+	if (njobs > 1 && !mm_stats[i].valid)
+	    continue;
+	trace = read_trace(tracedir, tracefiles[i], stream);
 	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
+	mm_stats[i].num_threads = trace->num_threads;
+	if (njobs == 1) {
 	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+		printf("Checking mm_malloc for correctness, ");
+	    mm_stats[i].valid = eval_mm_valid(trace, i, &ranges, &mm_stats[i]);
+	    if (mm_stats[i].valid) {
+		if (verbose > 1)
+		    printf("efficiency, ");
+		mm_stats[i].util = eval_mm_util(trace, i, &ranges,
+						&mm_stats[i]);
+	    }
+	}
+	if (mm_stats[i].valid) {
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
-		printf("and performance.\n");
+		printf(njobs > 1 ? "Checking mm_malloc for performance.\n" :
+		       "and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (perf) {
+		if (verbose > 1)
+		    printf("Counting hardware events.\n");
+		perf_start();
+		eval_mm_speed(&speed_params);
+		perf_stop(mm_stats[i].perf);
+		mm_stats[i].counted = 1;
+	    }
+	    if (latency) {
+		if (verbose > 1)
+		    printf("Timing every request.\n");
+		if ((mm_stats[i].lat = 
+		     (hist_t *)malloc(NUM_TYPES * sizeof(hist_t))) == NULL)
+		    unix_error("lat malloc in main failed");
+		eval_mm_latency(trace, mm_stats[i].lat);
+	    }
 	}
 	free_trace(trace);
     }
@@ -312,7 +481,21 @@ int main(int argc, char **argv)
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printcounters(num_tracefiles, mm_stats);
     }
+    if (latency && errors == 0)
+	printlatency(num_tracefiles, mm_stats);
+    if (sample_every > 0)
+	write_samples(sample_file, tracefiles, num_tracefiles, mm_stats);
+
+    /* Optionally measure how throughput scales with the number of threads */
+    if (nthreads > 0 && errors == 0)
+	eval_mm_scaling(tracefiles, num_tracefiles, nthreads, stream);
+
+    /* Replay the traces that say which thread makes each request that way
+       (which needs them whole) */
+    if (errors == 0 && !stream)
+	eval_mm_handoffs(tracefiles, num_tracefiles, mm_stats);
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -367,30 +550,108 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Since the 
+ * payloads in the tree never overlap each other, a new one can only
+ * overlap the payloads just below and just above it, so each check
+ * takes a single walk down the tree.
  ****************************************************************/
 
+/*
+ * new_range - Take a range record from the pool, refilling the pool
+ *     with RANGE_CHUNK more records first if it is empty. Records are
+ *     never given back to libc, only to the pool.
+ */
+static range_t *new_range(void)
+{
+    range_t *p;
+    int i;
+
+    if (free_ranges == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in new_range");
+	for (i = 0; i < RANGE_CHUNK; i++) {
+	    p[i].left = free_ranges;
+	    free_ranges = &p[i];
+	}
+    }
+    p = free_ranges;
+    free_ranges = p->left;
+    return p;
+}
+
+/*
+ * insert_range - Insert range p into the tree rooted at t and return
+ *     the new root. p goes in as a leaf and is rotated up for as long
+ *     as its priority beats its parent's.
+ */
+static range_t *insert_range(range_t *t, range_t *p)
+{
+    range_t *c;
+
+    if (t == NULL)
+	return p;
+    if (p->lo < t->lo) {
+	c = t->left = insert_range(t->left, p);
+	if (c->prio > t->prio) {      /* rotate c up to the right */
+	    t->left = c->right;
+	    c->right = t;
+	    return c;
+	}
+    }
+    else {
+	c = t->right = insert_range(t->right, p);
+	if (c->prio > t->prio) {      /* rotate c up to the left */
+	    t->right = c->left;
+	    c->left = t;
+	    return c;
+	}
+    }
+    return t;
+}
+
+/*
+ * join_ranges - Join trees l and r (every lo in l below every lo in
+ *     r) into one and return its root
+ */
+static range_t *join_ranges(range_t *l, range_t *r)
+{
+    if (l == NULL)
+	return r;
+    if (r == NULL)
+	return l;
+    if (l->prio > r->prio) {
+	l->right = join_ranges(l->right, r);
+	return l;
+    }
+    r->left = join_ranges(l, r->left);
+    return r;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     size bytes at addr lo, which must be aligned to align bytes. After
+ *     checking the block for correctness, we create a range struct for
+ *     this block and add it to the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+static int add_range(range_t **ranges, char *lo, int size, size_t align,
+		     int tracenum, int64_t opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
+    range_t *below = NULL;  /* the payload with the highest lo <= ours */
+    range_t *above = NULL;  /* the payload with the lowest lo > ours */
+    uintptr_t h;
     char msg[MAXLINE];
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
-	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-		lo, ALIGNMENT);
+    /* Payload addresses must be ALIGNMENT-byte aligned, or more if asked */
+    if (!IS_ALIGNED(lo) || (uintptr_t)lo % align != 0) {
+	sprintf(msg, "Payload address (%p) not aligned to %lu bytes", 
+		lo, (unsigned long)(align > ALIGNMENT ? align : ALIGNMENT));
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
@@ -405,26 +666,38 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    for (p = *ranges;  p != NULL;  ) {
+	if (p->lo <= lo) {
+	    below = p;
+	    p = p->right;
+	}
+	else {
+	    above = p;
+	    p = p->left;
+	}
+    }
+    if (below != NULL && below->hi >= lo)
+	p = below;
+    else if (above != NULL && above->lo <= hi)
+	p = above;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    h = (uintptr_t)lo * 0x9E3779B97F4A7C15ULL;  /* Fibonacci hashing */
+    p->prio = (unsigned)(h >> (8 * sizeof(uintptr_t) - 32));
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
@@ -434,17 +707,14 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    range_t **linkp = ranges;
+
+    for (p = *ranges;  p != NULL && p->lo != lo;  p = *linkp) 
+	linkp = (lo < p->lo) ? &p->left : &p->right;
+    if (p != NULL) {
+	*linkp = join_ranges(p->left, p->right);
+	p->left = free_ranges;
+	free_ranges = p;
     }
 }
 
@@ -453,140 +723,54 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    range_t *p = *ranges;
+
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    p->left = free_ranges;
+    free_ranges = p;
     *ranges = NULL;
 }
 
-
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
-
-/*
- * read_trace - read a trace file and store it in memory
- */
-static trace_t *read_trace(char *tracedir, char *filename)
-{
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
-
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
-}
-
-/*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
- */
-void free_trace(trace_t *trace)
-{
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
-
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * eval_mm_valid - Check the mm malloc package for correctness. Since
+ *    every payload gets written here, this is also where we measure how
+ *    much of the heap is resident in memory (stats->peak_rss and 
+ *    stats->final_rss). mem_heap_rss looks at every page, so the peak
+ *    is sampled: every RSS_EVERY requests, and whenever the heap has
+ *    grown by an eighth since the last sample. The allocator's mm_stats
+ *    counters at the end
+ *    of the trace go in stats->counters.
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 stats_t *stats) 
 {
-    int i, j;
+    int i, j, n;
     int index;
     int size;
     int oldsize;
+    int64_t opnum;
+    size_t blocksize;
+    size_t align;
     char *newp;
     char *oldp;
     char *p;
+    size_t rss, rss_heap = 0;
+    int since_rss = 0;
+    traceop_t *ops;
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     clear_ranges(ranges);
+    trace_rewind(trace);
+    stats->peak_rss = 0;
 
     /* Call the mm package's init function */
     if (mm_init() < 0) {
@@ -595,17 +779,30 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+    while ((n = trace_next(trace, &ops)) > 0)
+    for (i = 0;  i < n;  i++) {
+	index = ops[i].index;
+	size = ops[i].size;
+	opnum = trace->next - n + i;
 
-        switch (trace->ops[i].type) {
+        switch (ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    align = (ops[i].type == MEMALIGN) ? (size_t)1 << ops[i].align : 1;
+	    if (ops[i].type == MEMALIGN)
+		p = mm_memalign(align, size);
+	    else if (ops[i].type == CALLOC)
+		p = mm_calloc(1, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, opnum, ops[i].type == MEMALIGN ?
+			     "mm_memalign failed." : ops[i].type == CALLOC ?
+			     "mm_calloc failed." : "mm_malloc failed.");
 		return 0;
 	    }
 	    
@@ -614,8 +811,19 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, align, tracenum, opnum) == 0)
 		return 0;
+
+	    /* A calloc'ed block has to come back zeroed */
+	    if (ops[i].type == CALLOC) {
+		for (j = 0; j < size; j++) {
+		    if (p[j] != 0) {
+			malloc_error(tracenum, opnum, "mm_calloc did not zero "
+				     "the block");
+			return 0;
+		    }
+		}
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -625,16 +833,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    memset(p, index & 0xFF, size);
 
 	    /* Remember region */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+	    trace_set_block(trace, index, p, size);
 	    break;
 
         case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
-	    oldp = trace->blocks[index];
+	    oldp = trace_block(trace, index, &blocksize);
 	    if ((newp = mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
+		malloc_error(tracenum, opnum, "mm_realloc failed.");
 		return 0;
 	    }
 	    
@@ -642,7 +849,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(ranges, newp, size, 1, tracenum, opnum) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -650,11 +857,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * block and then fill in the new block with the low order byte
 	     * of the new index
 	     */
-	    oldsize = trace->block_sizes[index];
+	    oldsize = blocksize;
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
+		malloc_error(tracenum, opnum, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
 	      }
@@ -662,23 +869,35 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    memset(newp, index & 0xFF, size);
 
 	    /* Remember region */
-	    trace->blocks[index] = newp;
-	    trace->block_sizes[index] = size;
+	    trace_set_block(trace, index, newp, size);
 	    break;
 
         case FREE: /* mm_free */
 	    
 	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
+	    p = trace_block(trace, index, NULL);
 	    remove_range(ranges, p);
 	    mm_free(p);
+	    trace_drop_block(trace, index);
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Only writing a payload can bring more of the heap in */
+	if (ops[i].type != FREE && (++since_rss >= RSS_EVERY ||
+				    mem_heapsize() > rss_heap + rss_heap / 8)) {
+	    if ((rss = mem_heap_rss()) > stats->peak_rss)
+		stats->peak_rss = rss;
+	    rss_heap = mem_heapsize();
+	    since_rss = 0;
+	}
     }
+    stats->final_rss = mem_heap_rss();
+    if (stats->final_rss > stats->peak_rss)
+	stats->peak_rss = stats->final_rss;
+    mm_stats(&stats->counters);
 
     /* As far as we know, this is a valid malloc package */
     return 1;
@@ -689,40 +908,55 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest the heap got while running the student's malloc package
+ *   on the trace. mem_sbrk() lets the heap shrink again, so that is
+ *   mem_heap_peak() rather than where the brk ends up. 
  *   
+ *   With -u, the heap is also sampled every sample_every requests (and
+ *   at the end), into stats->samples, to show how the utilization and
+ *   fragmentation got where they ended up.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats)
 {   
-    int i;
+    int64_t opnum = 0;
+    int i, n;
     int index;
-    int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    int size, newsize;
+    size_t oldsize;
+    long long max_total_size = 0;
+    long long total_size = 0;
     char *p;
     char *newp, *oldp;
+    traceop_t *ops;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
+    trace_rewind(trace);
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    while ((n = trace_next(trace, &ops)) > 0)
+    for (i = 0;  i < n;  i++) {
+        switch (ops[i].type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-
-	    if ((p = mm_malloc(size)) == NULL) 
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
+	    index = ops[i].index;
+	    size = ops[i].size;
+
+	    if (ops[i].type == MEMALIGN)
+		p = mm_memalign((size_t)1 << ops[i].align, size);
+	    else if (ops[i].type == CALLOC)
+		p = mm_calloc(1, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+	    trace_set_block(trace, index, p, size);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -734,21 +968,19 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldsize = trace->block_sizes[index];
+	    index = ops[i].index;
+	    newsize = ops[i].size;
 
-	    oldp = trace->blocks[index];
+	    oldp = trace_block(trace, index, &oldsize);
 	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
-	    trace->blocks[index] = newp;
-	    trace->block_sizes[index] = newsize;
+	    trace_set_block(trace, index, newp, newsize);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
-	    total_size += (newsize - oldsize);
+	    total_size += (newsize - (long long)oldsize);
 	    
 	    /* Update statistics */
 	    max_total_size = (total_size > max_total_size) ?
@@ -756,15 +988,15 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
-	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
+	    index = ops[i].index;
+	    p = trace_block(trace, index, &oldsize);
 	    
 	    mm_free(p);
+	    trace_drop_block(trace, index);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
-	    total_size -= size;
+	    total_size -= oldsize;
 	    
 	    break;
 
@@ -772,20 +1004,46 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+	if (sample_every > 0 && ++opnum % sample_every == 0)
+	    sample_heap(stats, opnum, total_size);
     }
+    if (sample_every > 0 && opnum % sample_every != 0)
+	sample_heap(stats, opnum, total_size);
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* The heap may have shrunk since, so compare with its biggest size */
+    return ((double)max_total_size / (double)mem_heap_peak());
 }
 
 
+/*
+ * sample_heap - Add a sample of the mm heap as it is after op requests,
+ *    with payload bytes allocated, to stats->samples
+ */
+static void sample_heap(stats_t *stats, int64_t op, size_t payload)
+{
+    mm_stats_t counters;
+    sample_t *s;
+
+    if ((stats->num_samples & (stats->num_samples - 1)) == 0 &&
+	(stats->samples = (sample_t *)realloc(stats->samples,
+		(stats->num_samples ? 2 * stats->num_samples : 1) *
+		sizeof(sample_t))) == NULL)
+	unix_error("realloc failed in sample_heap");
+    mm_stats(&counters);
+    s = &stats->samples[stats->num_samples++];
+    s->op = op;
+    s->payload = payload;
+    s->heap = mem_heapsize();
+    s->free = counters.free_bytes;
+    s->largest_free = counters.largest_free;
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
@@ -793,31 +1051,119 @@ static void eval_mm_speed(void *ptr)
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
+    replay_mm(trace);
+}
+
+/*
+ * eval_mm_latency - Replay the trace LAT_RUNS times, reading the time
+ *    stamp counter around every request, and count how many ticks each
+ *    one took (less the overhead of reading the counter) in lat[type],
+ *    one histogram per type of request.
+ */
+static void eval_mm_latency(trace_t *trace, hist_t *lat)
+{
+    int i, n, run, type;
+    unsigned long long t0, t1, ovhd = tsc_ovhd();
+    traceop_t *op, *ops;
+    char *p = NULL;
+
+    for (type = 0; type < NUM_TYPES; type++)
+	hist_reset(&lat[type]);
+    for (run = 0; run < LAT_RUNS; run++) {
+	mem_reset_brk();
+	trace_rewind(trace);
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_latency");
+
+	while ((n = trace_next(trace, &ops)) > 0)
+	for (i = 0; i < n; i++) {
+	    op = &ops[i];
+	    t0 = read_tsc();
+	    switch (op->type) {
+	    case ALLOC:
+		p = mm_malloc(op->size);
+		break;
+	    case REALLOC:
+		p = mm_realloc(trace_block(trace, op->index, NULL), op->size);
+		break;
+	    case FREE:
+		mm_free(trace_block(trace, op->index, NULL));
+		break;
+	    case MEMALIGN:
+		p = mm_memalign((size_t)1 << op->align, op->size);
+		break;
+	    case CALLOC:
+		p = mm_calloc(1, op->size);
+		break;
+	    }
+	    t1 = read_tsc();
+
+	    if (op->type != FREE) {
+		if (p == NULL)
+		    app_error("mm_malloc, mm_realloc, mm_memalign or mm_calloc "
+			      "error in eval_mm_latency");
+		trace_set_block(trace, op->index, p, op->size);
+	    } else
+		trace_drop_block(trace, op->index);
+	    hist_add(&lat[op->type], t1 - t0 > ovhd ? t1 - t0 - ovhd : 0);
+	}
+    }
+}
+
+/*
+ * replay_mm - Run every request of the trace through the mm malloc
+ *    package, without checking anything. The heap must be initialized.
+ */
+static void replay_mm(trace_t *trace)
+{
+    int i, n, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    traceop_t *ops;
+
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    while ((n = trace_next(trace, &ops)) > 0)
+    for (i = 0;  i < n;  i++)
+        switch (ops[i].type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = ops[i].index;
+            size = ops[i].size;
             if ((p = mm_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
+            trace_set_block(trace, index, p, size);
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            index = ops[i].index;
+            size = ops[i].size;
+            if ((p = mm_memalign((size_t)1 << ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace_set_block(trace, index, p, size);
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = ops[i].index;
+            size = ops[i].size;
+            if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace_set_block(trace, index, p, size);
             break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
+	    index = ops[i].index;
+            newsize = ops[i].size;
+	    oldp = trace_block(trace, index, NULL);
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
+            trace_set_block(trace, index, newp, newsize);
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
+            index = ops[i].index;
+            block = trace_block(trace, index, NULL);
             mm_free(block);
+            trace_drop_block(trace, index);
             break;
 
 	default:
@@ -825,6 +1171,322 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * mt_replay - The body of one thread of the multithreaded replay: wait
+ *    for every other thread to be ready and then replay its trace.
+ */
+static void *mt_replay(void *ptr)
+{
+    mt_arg_t *arg = (mt_arg_t *)ptr;
+
+    pthread_barrier_wait(arg->start);
+    replay_mm(arg->trace);
+    return NULL;
+}
+
+/*
+ * eval_mm_mt - Return the wall clock time needed to replay the nthreads
+ *    traces on one mm heap, either concurrently on nthreads threads
+ *    (parallel) or one after another on the calling thread. The best of
+ *    MT_RUNS runs is returned.
+ */
+static double eval_mm_mt(trace_t **traces, int nthreads, int parallel)
+{
+    int i, run;
+    double start, secs, best = DBL_MAX;
+    struct timespec ts;
+    pthread_t *tids;
+    mt_arg_t *args;
+    pthread_barrier_t barrier;
+
+    if ((tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t))) == NULL ||
+	(args = (mt_arg_t *)calloc(nthreads, sizeof(mt_arg_t))) == NULL)
+	unix_error("calloc failed in eval_mm_mt");
+
+    for (run = 0; run < MT_RUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_mt");
+
+	if (parallel) {
+	    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	    for (i = 0; i < nthreads; i++) {
+		args[i].trace = traces[i];
+		args[i].start = &barrier;
+		if (pthread_create(&tids[i], NULL, mt_replay, &args[i]) != 0)
+		    app_error("pthread_create failed in eval_mm_mt");
+	    }
+	    pthread_barrier_wait(&barrier);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = ts.tv_sec + ts.tv_nsec / 1e9;
+	for (i = 0; i < nthreads; i++) {
+	    if (parallel)
+		pthread_join(tids[i], NULL);
+	    else
+		replay_mm(traces[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	secs = ts.tv_sec + ts.tv_nsec / 1e9 - start;
+	if (parallel)
+	    pthread_barrier_destroy(&barrier);
+	if (secs < best)
+	    best = secs;
+    }
+
+    free(tids);
+    free(args);
+    return best;
+}
+
+/*
+ * eval_mm_scaling - Replay nthreads traces (thread i gets trace i modulo
+ *    the number of traces) concurrently on nthreads threads and compare
+ *    the aggregate throughput with replaying the same traces on one thread.
+ *    The heap column is how far the heap (all of its arenas) grew.
+ *    With stream, every thread streams its own copy of its trace.
+ */
+static void eval_mm_scaling(char **tracefiles, int num_tracefiles, int nthreads,
+			    int stream)
+{
+    int i;
+    double ops = 0, secs1, secsn, tput1, tputn;
+    size_t heap1, heapn;
+    trace_t **traces;
+
+    if ((traces = (trace_t **)calloc(nthreads, sizeof(trace_t *))) == NULL)
+	unix_error("calloc failed in eval_mm_scaling");
+    for (i = 0; i < nthreads; i++) {
+	traces[i] = read_trace(tracedir, tracefiles[i % num_tracefiles],
+			       stream);
+	ops += traces[i]->num_ops;
+    }
+
+    secs1 = eval_mm_mt(traces, nthreads, 0);
+    heap1 = mem_heap_peak();
+    secsn = eval_mm_mt(traces, nthreads, 1);
+    heapn = mem_heap_peak();
+    tput1 = ops / secs1;
+    tputn = ops / secsn;
+
+    printf("Results for mm malloc on %d threads:\n", nthreads);
+    printf("%10s%10s%10s%10s%10s\n", "threads", "ops", "secs", "Kops", "heap(KB)");
+    printf("%10d%10.0f%10.6f%10.0f%10lu\n", 1, ops, secs1, tput1 / 1e3,
+	   (unsigned long)(heap1 / 1024));
+    printf("%10d%10.0f%10.6f%10.0f%10lu\n", nthreads, ops, secsn, tputn / 1e3,
+	   (unsigned long)(heapn / 1024));
+    printf("Speedup %.2fx, scaling efficiency %.0f%%\n\n",
+	   tputn / tput1, 100.0 * tputn / (tput1 * nthreads));
+
+    for (i = 0; i < nthreads; i++)
+	free_trace(traces[i]);
+    free(traces);
+}
+
+/*
+ * mt_handoff - Thread body for eval_mm_handoff: make the requests of
+ *    thread tid in trace order. A request waits until every earlier
+ *    request on its block is done, whichever thread made it, so a
+ *    block is never freed before the thread that mallocs it has it.
+ */
+static void *mt_handoff(void *ptr)
+{
+    mt_arg_t *arg = (mt_arg_t *)ptr;
+    trace_t *trace = arg->trace;
+    traceop_t *op;
+    char *p;
+    int i;
+
+    pthread_barrier_wait(arg->start);
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if (op->tid != arg->tid)
+	    continue;
+	while (__atomic_load_n(&arg->done[op->index], __ATOMIC_ACQUIRE) != op->seq)
+	    sched_yield();
+
+	switch (op->type) {
+	case ALLOC:
+	    if ((p = mm_malloc(op->size)) == NULL)
+		app_error("mm_malloc error in eval_mm_handoff");
+	    trace->blocks[op->index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[op->index], op->size)) == NULL)
+		app_error("mm_realloc error in eval_mm_handoff");
+	    trace->blocks[op->index] = p;
+	    break;
+	case MEMALIGN:
+	    if ((p = mm_memalign((size_t)1 << op->align, op->size)) == NULL)
+		app_error("mm_memalign error in eval_mm_handoff");
+	    trace->blocks[op->index] = p;
+	    break;
+	case CALLOC:
+	    if ((p = mm_calloc(1, op->size)) == NULL)
+		app_error("mm_calloc error in eval_mm_handoff");
+	    trace->blocks[op->index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[op->index]);
+	    break;
+	}
+	__atomic_store_n(&arg->done[op->index], op->seq + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * eval_mm_handoff - Return the wall clock time needed to replay a trace
+ *    with thread ids on that many threads, each making its own requests.
+ *    The best of MT_RUNS runs is returned.
+ */
+static double eval_mm_handoff(trace_t *trace)
+{
+    int i, run, nthreads = trace->num_threads;
+    double start, secs, best = DBL_MAX;
+    struct timespec ts;
+    pthread_t *tids;
+    mt_arg_t *args;
+    int *done;
+    pthread_barrier_t barrier;
+
+    if ((tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t))) == NULL ||
+	(args = (mt_arg_t *)calloc(nthreads, sizeof(mt_arg_t))) == NULL ||
+	(done = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc failed in eval_mm_handoff");
+
+    for (run = 0; run < MT_RUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_handoff");
+	memset(done, 0, trace->num_ids * sizeof(int));
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+	    args[i].trace = trace;
+	    args[i].start = &barrier;
+	    args[i].tid = i;
+	    args[i].done = done;
+	    if (pthread_create(&tids[i], NULL, mt_handoff, &args[i]) != 0)
+		app_error("pthread_create failed in eval_mm_handoff");
+	}
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = ts.tv_sec + ts.tv_nsec / 1e9;
+	for (i = 0; i < nthreads; i++)
+	    pthread_join(tids[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	secs = ts.tv_sec + ts.tv_nsec / 1e9 - start;
+	pthread_barrier_destroy(&barrier);
+	if (secs < best)
+	    best = secs;
+    }
+
+    free(tids);
+    free(args);
+    free(done);
+    return best;
+}
+
+/*
+ * eval_mm_handoffs - Replay every trace that has thread ids on its
+ *    threads and print how long that took next to replaying it on
+ *    one thread. Traces too long to hold in memory are left out. The
+ *    main loop already read every trace, so stats says which ones are
+ *    threaded and only those are read again.
+ */
+static void eval_mm_handoffs(char **tracefiles, int num_tracefiles,
+			     stats_t *stats)
+{
+    int i, header = 0;
+    double secs1, secsn;
+    trace_t *trace;
+    speed_t speed_params;
+
+    for (i = 0; i < num_tracefiles; i++) {
+	if (stats[i].num_threads <= 1)
+	    continue;
+	trace = read_trace(tracedir, tracefiles[i], 0);
+	if (trace->stream == NULL) {
+	    if (!header) {
+		printf("Results for mm malloc on threaded traces:\n");
+		printf("%5s%8s%10s%12s%10s%10s\n",
+		       "trace", "threads", "ops", "1 thr Kops", "secs", "Kops");
+		header = 1;
+	    }
+	    speed_params.trace = trace;
+	    secs1 = fsecs(eval_mm_speed, &speed_params);
+	    secsn = eval_mm_handoff(trace);
+	    printf("%5d%8d%10lld%12.0f%10.6f%10.0f\n", i, trace->num_threads,
+		   (long long)trace->num_ops, trace->num_ops / secs1 / 1e3, secsn,
+		   trace->num_ops / secsn / 1e3);
+	}
+	free_trace(trace);
+    }
+    if (header)
+	printf("\n");
+}
+
+/*
+ * check_worker - Thread body for eval_mm_checks: make a heap of our own
+ *    and check traces in it for correctness and utilization, taking the
+ *    next one nobody has taken yet until there are none left.
+ */
+static void *check_worker(void *ptr)
+{
+    check_arg_t *arg = (check_arg_t *)ptr;
+    range_t *ranges = NULL;
+    trace_t *trace;
+    mm_heap_t *heap;
+    int i;
+
+    if ((heap = mm_heap_create()) == NULL)
+	app_error("mm_heap_create failed in check_worker");
+    mm_heap_use(heap);
+    if (mm_arenas(arg->narenas, arg->arena_policy) < 0)
+	app_error("mm_arenas failed in check_worker");
+
+    while ((i = __atomic_fetch_add(&arg->next, 1, __ATOMIC_RELAXED)) <
+	   arg->num_tracefiles) {
+	trace = read_trace(tracedir, arg->tracefiles[i], arg->stream);
+	arg->stats[i].ops = trace->num_ops;
+	arg->stats[i].valid = eval_mm_valid(trace, i, &ranges, &arg->stats[i]);
+	if (arg->stats[i].valid)
+	    arg->stats[i].util = eval_mm_util(trace, i, &ranges,
+					      &arg->stats[i]);
+	free_trace(trace);
+    }
+
+    clear_ranges(&ranges);
+    mm_heap_use(NULL);
+    mm_heap_destroy(heap);
+    return NULL;
+}
+
+/*
+ * eval_mm_checks - Check every trace of arg for correctness and
+ *    utilization on njobs threads (never more than there are traces),
+ *    each with a heap of its own, so the traces don't have to wait for
+ *    each other. The results go where eval_mm_valid and eval_mm_util
+ *    would have put them.
+ */
+static void eval_mm_checks(check_arg_t *arg, int njobs)
+{
+    int i;
+    pthread_t *tids;
+
+    if (njobs > arg->num_tracefiles)
+	njobs = arg->num_tracefiles;
+    if ((tids = (pthread_t *)calloc(njobs, sizeof(pthread_t))) == NULL)
+	unix_error("calloc failed in eval_mm_checks");
+    for (i = 0; i < njobs; i++)
+	if (pthread_create(&tids[i], NULL, check_worker, arg) != 0)
+	    app_error("pthread_create failed in eval_mm_checks");
+    for (i = 0; i < njobs; i++)
+	pthread_join(tids[i], NULL);
+    free(tids);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -833,32 +1495,54 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, n, newsize;
     char *p, *newp, *oldp;
+    traceop_t *ops;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    while ((n = trace_next(trace, &ops)) > 0)
+    for (i = 0;  i < n;  i++) {
+        switch (ops[i].type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
+	    if ((p = malloc(ops[i].size)) == NULL) {
+		malloc_error(tracenum, trace->next - n + i, "libc malloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    trace_set_block(trace, ops[i].index, p, ops[i].size);
+	    break;
+
+	case MEMALIGN: /* aligned_alloc */
+	    if ((p = aligned_alloc((size_t)1 << ops[i].align,
+				   ops[i].size)) == NULL) {
+		malloc_error(tracenum, trace->next - n + i,
+			     "libc aligned_alloc failed");
+		unix_error("System message");
+	    }
+	    trace_set_block(trace, ops[i].index, p, ops[i].size);
+	    break;
+
+	case CALLOC: /* calloc */
+	    if ((p = calloc(1, ops[i].size)) == NULL) {
+		malloc_error(tracenum, trace->next - n + i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace_set_block(trace, ops[i].index, p, ops[i].size);
 	    break;
 
 	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
+            newsize = ops[i].size;
+	    oldp = trace_block(trace, ops[i].index, NULL);
 	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
+		malloc_error(tracenum, trace->next - n + i, "libc realloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	    trace_set_block(trace, ops[i].index, newp, newsize);
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    free(trace_block(trace, ops[i].index, NULL));
+	    trace_drop_block(trace, ops[i].index);
 	    break;
 
 	default:
@@ -876,35 +1560,55 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, n;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    traceop_t *ops;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    while ((n = trace_next(trace, &ops)) > 0)
+    for (i = 0;  i < n;  i++) {
+        switch (ops[i].type) {
         case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = ops[i].index;
+	    size = ops[i].size;
 	    if ((p = malloc(size)) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
+	    trace_set_block(trace, index, p, size);
+	    break;
+
+	case MEMALIGN: /* aligned_alloc */
+	    index = ops[i].index;
+	    size = ops[i].size;
+	    if ((p = aligned_alloc((size_t)1 << ops[i].align, size)) == NULL)
+		unix_error("aligned_alloc failed in eval_libc_speed");
+	    trace_set_block(trace, index, p, size);
+	    break;
+
+	case CALLOC: /* calloc */
+	    index = ops[i].index;
+	    size = ops[i].size;
+	    if ((p = calloc(1, size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace_set_block(trace, index, p, size);
 	    break;
 
 	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
+	    index = ops[i].index;
+	    newsize = ops[i].size;
+	    oldp = trace_block(trace, index, NULL);
 	    if ((newp = realloc(oldp, newsize)) == NULL)
 		unix_error("realloc failed in eval_libc_speed\n");
 	    
-	    trace->blocks[index] = newp;
+	    trace_set_block(trace, index, newp, newsize);
 	    break;
 	    
         case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
+	    index = ops[i].index;
+	    block = trace_block(trace, index, NULL);
 	    free(block);
+	    trace_drop_block(trace, index);
 	    break;
 	}
     }
@@ -926,17 +1630,19 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%9s%9s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "peakKB", "finalKB");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f%9lu%9lu\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   (unsigned long)(stats[i].peak_rss / 1024),
+		   (unsigned long)(stats[i].final_rss / 1024));
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -970,6 +1676,191 @@ static void printresults(int n, stats_t *stats)
 	       "-");
     }
 
+    /* Print the hardware events per request, if we counted them */
+    for (i = 0; i < n && !stats[i].counted; i++)
+	;
+    if (i < n)
+	printperf(n, stats);
+
+}
+
+/*
+ * printperf - Print how many of each hardware event every request of
+ *    each trace caused on average, and over all of them
+ */
+static void printperf(int n, stats_t *stats)
+{
+    double total[PERF_NUM], ops = 0;
+    int i, j;
+
+    printf("\nHardware events per request:\n");
+    printf("%5s", "trace");
+    for (j = 0; j < PERF_NUM; j++) {
+	printf("%10s", perf_name(j));
+	total[j] = 0;
+    }
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].counted)
+	    continue;
+	printf("%5d", i);
+	for (j = 0; j < PERF_NUM; j++) {
+	    if (stats[i].perf[j] < 0 || total[j] < 0) {
+		total[j] = -1;  /* unknown in one trace, unknown in total */
+		if (stats[i].perf[j] < 0) {
+		    printf("%10s", "-");
+		    continue;
+		}
+	    }
+	    else
+		total[j] += stats[i].perf[j];
+	    printf("%10.2f", stats[i].perf[j] / stats[i].ops);
+	}
+	printf("\n");
+	ops += stats[i].ops;
+    }
+    printf("%5s", "Total");
+    for (j = 0; j < PERF_NUM; j++) {
+	if (total[j] < 0)
+	    printf("%10s", "-");
+	else
+	    printf("%10.2f", total[j] / ops);
+    }
+    printf("\n");
+}
+
+/*
+ * printcounters - Print the mm_stats counters of each valid trace as
+ *    they stood at the end of it: how often (and by how much) the heap
+ *    grew, how often it coalesced, split and resized blocks and emptied
+ *    its fast bins, how many callocs got a block that was already zero,
+ *    and what the free space looked like
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    static char *classes[] = {"<32", "<64", "<128", "<256", "<512", "<1K",
+			      "tree"};
+    mm_stats_t *c;
+    int i, j;
+
+    printf("Allocator counters at the end of each trace:\n");
+    printf("%5s%8s%8s%8s%8s%8s%8s%9s%9s%9s%9s%8s%8s\n",
+	   "trace", "extends", "extKB", "coal1", "coal2", "coal3", "coal4",
+	   "splits", "rgrow", "rshrink", "rmove", "consol", "czero");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	c = &stats[i].counters;
+	printf("%5d%8lu%8lu%8lu%8lu%8lu%8lu%9lu%9lu%9lu%9lu%8lu%8lu\n", i,
+	       (unsigned long)c->extends,
+	       (unsigned long)(c->extend_bytes / 1024),
+	       (unsigned long)c->coalesces[0], (unsigned long)c->coalesces[1],
+	       (unsigned long)c->coalesces[2], (unsigned long)c->coalesces[3],
+	       (unsigned long)c->splits, (unsigned long)c->realloc_grows,
+	       (unsigned long)c->realloc_shrinks,
+	       (unsigned long)c->realloc_moves,
+	       (unsigned long)c->consolidations,
+	       (unsigned long)c->calloc_zeroed);
+    }
+    printf("\n%5s%8s%8s%8s%8s%10s", "trace", "liveKB", "freeKB", "fastKB",
+	   "heapKB", "maxfree");
+    for (j = 0; j < MM_FREE_CLASSES; j++)
+	printf("%7s", classes[j]);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	c = &stats[i].counters;
+	printf("%5d%8lu%8lu%8lu%8lu%10lu", i,
+	       (unsigned long)(c->live_bytes / 1024),
+	       (unsigned long)(c->free_bytes / 1024),
+	       (unsigned long)(c->fast_bytes / 1024),
+	       (unsigned long)(c->heap_bytes / 1024),
+	       (unsigned long)c->largest_free);
+	for (j = 0; j < MM_FREE_CLASSES; j++)
+	    printf("%7lu", (unsigned long)c->free_blocks[j]);
+	printf("\n");
+    }
+    printf("\n");
+}
+
+/*
+ * write_samples - Write the -u samples of every valid trace to path as
+ *    CSV, one line per sample. util is the payload over the heap size
+ *    and frag the external fragmentation, 1 - largest_free/free (0 when
+ *    nothing is free).
+ */
+static void write_samples(char *path, char **tracefiles, int n,
+			  stats_t *stats)
+{
+    FILE *fp;
+    sample_t *s;
+    int64_t j;
+    int i;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	unix_error("fopen failed in write_samples");
+    fprintf(fp, "trace,file,op,payload,heap,free,largest_free,util,frag\n");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	for (j = 0; j < stats[i].num_samples; j++) {
+	    s = &stats[i].samples[j];
+	    fprintf(fp, "%d,%s,%lld,%lu,%lu,%lu,%lu,%.4f,%.4f\n", i,
+		    tracefiles[i], (long long)s->op,
+		    (unsigned long)s->payload, (unsigned long)s->heap,
+		    (unsigned long)s->free, (unsigned long)s->largest_free,
+		    s->heap ? (double)s->payload / s->heap : 0.0,
+		    s->free ? 1.0 - (double)s->largest_free / s->free : 0.0);
+	}
+	free(stats[i].samples);
+	stats[i].samples = NULL;
+    }
+    if (fclose(fp) != 0)
+	unix_error("fclose failed in write_samples");
+    if (verbose > 1)
+	printf("Wrote the heap samples to %s\n", path);
+}
+
+/*
+ * printlatency - Print the latency percentiles of each type of request
+ *    in each trace, and over all of them, in nanoseconds
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static char *names[] = {"malloc", "free", "realloc", "memalign", "calloc"};
+    static double pcts[] = {0.5, 0.9, 0.99, 0.999};
+    hist_t *total;
+    hist_t *h;
+    double ns = 1e3 / tsc_mhz(); /* nanoseconds per tick */
+    int i, type, j;
+
+    if ((total = (hist_t *)calloc(NUM_TYPES, sizeof(hist_t))) == NULL)
+	unix_error("calloc failed in printlatency");
+
+    printf("Latency of mm malloc requests in ns (%d replays, timer overhead "
+	   "subtracted):\n", LAT_RUNS);
+    printf("%5s%9s%10s%8s%8s%8s%8s%8s\n", 
+	   "trace", "op", "ops", "p50", "p90", "p99", "p999", "max");
+    for (i = 0; i <= n; i++) {
+	for (type = 0; type < NUM_TYPES; type++) {
+	    h = (i < n) ? &stats[i].lat[type] : &total[type];
+	    if (h->n == 0)
+		continue;
+	    if (i < n) {
+		hist_merge(&total[type], h);
+		printf("%5d", i);
+	    }
+	    else
+		printf("%5s", "Total");
+	    printf("%9s%10llu", names[type], h->n);
+	    for (j = 0; j < 4; j++)
+		printf("%8.0f", hist_percentile(h, pcts[j]) * ns);
+	    printf("%8.0f\n", h->max * ns);
+	}
+    }
+    printf("\n");
+    free(total);
 }
 
 /* 
@@ -993,10 +1884,11 @@ void unix_error(char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(int tracenum, int64_t opnum, char *msg)
 {
-    errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+    printf("ERROR [trace %d, line %lld]: %s\n", tracenum,
+	   (long long)LINENUM(opnum), msg);
 }
 
 /* 
@@ -1004,14 +1896,24 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVals] [-f <file>] [-t <dir>] [-p <n>] [-j <n>]\n"
+	    "               [-u <n> [-o <file>]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Check <n> traces at once, each in a heap of its own.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print the latency distribution of mm requests.\n");
+    fprintf(stderr, "\t-C         Bind threads to arenas by CPU (default round robin).\n");
+    fprintf(stderr, "\t-n <n>     Split the mm heap into <n> arenas.\n");
+    fprintf(stderr, "\t-o <file>  Write the -u samples to <file> (default util.csv).\n");
+    fprintf(stderr, "\t-p <n>     Also replay the traces on <n> threads at once.\n");
+    fprintf(stderr, "\t-P         Count hardware events (cache misses etc.) per request.\n");
+    fprintf(stderr, "\t-s         Stream the traces instead of reading them whole.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-u <n>     Sample the heap's utilization and fragmentation every <n> requests.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
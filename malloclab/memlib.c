@@ -1,7 +1,19 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ * The model reserves MAX_HEAP bytes of address space with mmap, but no
+ * memory: pages are made accessible as the brk grows past them, and
+ * given back to the OS (and made inaccessible again) when it shrinks.
+ * Every byte past a brk reads as zero, so the allocator knows that the
+ * memory an sbrk hands it is zeroed.
+ *
+ * There can be any number of models (mem_create), each with its own
+ * address space and brks. Every function below works on the calling
+ * thread's current model, which is the one mem_init sets up unless the
+ * thread picked another with mem_use, so threads working on different
+ * models never see each other.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,82 +26,329 @@
 #include "memlib.h"
 #include "config.h"
 
+/* One model of the memory system */
+struct mem {
+    char *start_brk;  /* points to first byte of heap */
+    char *max_addr;   /* largest legal heap address */
+
+    /*
+     * The heap can be split into regions, each with its own brk, so that
+     * several arenas can grow independently. Region r spans
+     * [start_brk + r*region_size, ... + region_size).
+     */
+    int num_regions;
+    size_t region_size;
+    char *brks[MAX_ARENAS];    /* points to last byte of each region */
+    char *commits[MAX_ARENAS]; /* end of the accessible pages of each */
+
+    size_t size;  /* bytes between the start and brk of every region */
+    size_t peak;  /* largest size since the last mem_reset_brk */
+    unsigned char *vec; /* page residency buffer of mem_heap_rss */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_t mem_default;              /* the model mem_init sets up */
+static __thread mem_t *mem_cur = &mem_default; /* this thread's model */
+
+/*
+ * mem_commit - make the pages of region r up to (and including) the one
+ *    holding byte end-1 accessible. Returns 0, or -1 if mprotect fails.
+ */
+static int mem_commit(int r, char *end)
+{
+    mem_t *m = mem_cur;
+    size_t pagesize = mem_pagesize();
+    char *top = m->start_brk +
+	((size_t)(end - m->start_brk) + pagesize - 1) / pagesize * pagesize;
+
+    if (top <= m->commits[r])
+	return 0;
+    if (mprotect(m->commits[r], top - m->commits[r],
+		 PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    m->commits[r] = top;
+    return 0;
+}
+
+/*
+ * mem_release - give the pages of region r above the one holding byte
+ *    end-1 back to the OS and make them inaccessible again. What is left
+ *    of the page holding end-1 is zeroed, as the OS would have.
+ */
+static void mem_release(int r, char *end)
+{
+    mem_t *m = mem_cur;
+    size_t pagesize = mem_pagesize();
+    char *top = m->start_brk +
+	((size_t)(end - m->start_brk) + pagesize - 1) / pagesize * pagesize;
+
+    if (end < top && end < m->brks[r])
+	memset(end, 0, (top < m->brks[r] ? top : m->brks[r]) - end);
+    if (top >= m->commits[r])
+	return;
+    madvise(top, m->commits[r] - top, MADV_DONTNEED);
+    mprotect(top, m->commits[r] - top, PROT_NONE);
+    m->commits[r] = top;
+}
+
+/*
+ * mem_setup - reserve the address space of model m and make it an
+ *    empty heap of one region. Returns 0, or -1 if mmap fails.
+ */
+static int mem_setup(mem_t *m)
+{
+    mem_t *saved = mem_cur;
+
+    /* reserve the address space we will use to model the available VM */
+    m->start_brk = (char *)mmap(NULL, MAX_HEAP, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				-1, 0);
+    if (m->start_brk == MAP_FAILED)
+	return -1;
+
+    m->max_addr = m->start_brk + MAX_HEAP;  /* max legal heap address */
+    m->num_regions = 1;
+    m->region_size = MAX_HEAP;
+    m->commits[0] = m->start_brk;           /* nothing is accessible */
+    mem_cur = m;
+    mem_reset_brk();                        /* heap is empty initially */
+    mem_cur = saved;
+    return 0;
+}
 
-/* 
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_setup(&mem_default) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_default.start_brk, MAX_HEAP);
+    free(mem_default.vec);
+    mem_default.vec = NULL;
+}
+
+/*
+ * mem_create - a new model of the memory system, independent of every
+ *    other one, or NULL if there is no room for it
+ */
+mem_t *mem_create(void)
+{
+    mem_t *m;
+
+    if ((m = (mem_t *)calloc(1, sizeof(mem_t))) == NULL)
+	return NULL;
+    if (mem_setup(m) < 0) {
+	free(m);
+	return NULL;
+    }
+    return m;
+}
+
+/*
+ * mem_destroy - free a model made by mem_create. No thread may be
+ *    using it anymore.
+ */
+void mem_destroy(mem_t *m)
+{
+    if (m == NULL)
+	return;
+    munmap(m->start_brk, MAX_HEAP);
+    free(m->vec);
+    free(m);
+}
+
+/*
+ * mem_use - make m (the mem_init one if NULL) the model of the calling
+ *    thread, and return the one it used before
+ */
+mem_t *mem_use(mem_t *m)
+{
+    mem_t *old = mem_cur;
+
+    mem_cur = m ? m : &mem_default;
+    return old;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make an empty heap,
+ *    giving every page of the old one back to the OS
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_t *m = mem_cur;
+    int r;
+
+    for (r = 0; r < m->num_regions; r++) {
+	m->brks[r] = (char *)mem_region_lo(r);
+	mem_release(r, m->brks[r]);
+	m->commits[r] = m->brks[r];
+    }
+    m->size = m->peak = 0;
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_regions - split the heap into n equal regions (a multiple of the
+ *    page size each) with a brk of their own, and empty all of them.
+ *    Returns 0, or -1 if n is out of range.
  */
-void *mem_sbrk(int incr) 
+int mem_regions(int n)
 {
-    char *old_brk = mem_brk;
+    mem_t *m = mem_cur;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (n < 1 || n > MAX_ARENAS)
+	return -1;
+    mem_reset_brk();
+    m->num_regions = n;
+    m->region_size = (n == 1) ? MAX_HEAP :
+	MAX_HEAP / n / mem_pagesize() * mem_pagesize();
+    mem_reset_brk();
+    return 0;
+}
+
+/*
+ * mem_region_sbrk - simple model of the sbrk function. Extends region r
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the region, and the whole pages it no longer
+ *    reaches go back to the OS. Only one thread at a time may change a
+ *    given region.
+ */
+void *mem_region_sbrk(int r, intptr_t incr)
+{
+    mem_t *m = mem_cur;
+    char *old_brk = m->brks[r];
+    char *min_addr = (char *)mem_region_lo(r);
+    char *max_addr = m->start_brk + (r + 1) * m->region_size;
+    size_t size, peak;
+
+    if (max_addr > m->max_addr)
+	max_addr = m->max_addr;
+    if ((incr < 0 && -incr > old_brk - min_addr) ||
+	(incr > 0 && incr > max_addr - old_brk)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    if (incr > 0 && mem_commit(r, old_brk + incr) < 0) {
+	fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	return (void *)-1;
+    }
+    if (incr < 0)
+	mem_release(r, old_brk + incr);
+    m->brks[r] += incr;
+
+    /* Other regions may be changing at the same time */
+    size = __atomic_add_fetch(&m->size, incr, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&m->peak, __ATOMIC_RELAXED);
+    while (size > peak &&
+	   !__atomic_compare_exchange_n(&m->peak, &peak, size, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
     return (void *)old_brk;
 }
 
+/*
+ * mem_sbrk - extend the first (or only) region by incr bytes
+ */
+void *mem_sbrk(intptr_t incr)
+{
+    return mem_region_sbrk(0, incr);
+}
+
+/*
+ * mem_region_lo - return address of the first byte of region r
+ */
+void *mem_region_lo(int r)
+{
+    return (void *)(mem_cur->start_brk + r * mem_cur->region_size);
+}
+
+/*
+ * mem_region_hi - return address of last byte in use in region r
+ */
+void *mem_region_hi(int r)
+{
+    return (void *)(mem_cur->brks[r] - 1);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return (void *)mem_cur->start_brk;
 }
 
-/* 
- * mem_heap_hi - return address of last heap byte
+/*
+ * mem_heap_hi - return address of last heap byte (of the last region
+ *    that has any)
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    mem_t *m = mem_cur;
+    int r;
+
+    for (r = m->num_regions - 1; r > 0; r--)
+	if (m->brks[r] > (char *)mem_region_lo(r))
+	    break;
+    return (void *)(m->brks[r] - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over all regions
  */
-size_t mem_heapsize() 
+size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    mem_t *m = mem_cur;
+    size_t size = 0;
+    int r;
+
+    for (r = 0; r < m->num_regions; r++)
+	size += (size_t)(m->brks[r] - (char *)mem_region_lo(r));
+    return size;
+}
+
+/*
+ * mem_heap_peak() - returns the largest heap size in bytes (summed over
+ *    all regions) since the heap was last reset
+ */
+size_t mem_heap_peak()
+{
+    return mem_cur->peak;
+}
+
+/*
+ * mem_heap_rss() - returns the number of bytes of the heap that are
+ *    resident in physical memory right now
+ */
+size_t mem_heap_rss()
+{
+    mem_t *m = mem_cur;
+    size_t pagesize = mem_pagesize();
+    size_t pages, i, rss = 0;
+    int r;
+
+    if (m->vec == NULL &&
+	(m->vec = (unsigned char *)malloc(MAX_HEAP / pagesize + 1)) == NULL)
+	return 0;
+    for (r = 0; r < m->num_regions; r++) {
+	pages = (m->commits[r] - (char *)mem_region_lo(r)) / pagesize;
+	if (pages == 0 ||
+	    mincore(mem_region_lo(r), pages * pagesize, m->vec) < 0)
+	    continue;
+	for (i = 0; i < pages; i++)
+	    rss += (m->vec[i] & 1) * pagesize;
+    }
+    return rss;
 }
 
 /*
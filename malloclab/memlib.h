@@ -1,11 +1,24 @@
 #include <unistd.h>
+#include <stdint.h>
+
+/* A model of the memory system, see mem_create */
+typedef struct mem mem_t;
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+mem_t *mem_create(void);
+void mem_destroy(mem_t *m);
+mem_t *mem_use(mem_t *m);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
+int mem_regions(int n);
+void *mem_region_sbrk(int r, intptr_t incr);
+void *mem_region_lo(int r);
+void *mem_region_hi(int r);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
+size_t mem_heap_rss(void);
 size_t mem_pagesize(void);
 
@@ -13,28 +13,48 @@ Our implementation uses the following to achieve those goals
 
 A) Keep track of Allocated and Free blocks - Implicit Free List DMA implementation 
 We maintain an implicit free list that embeds data in the blocks themselves that enable us to distinguish between allocated and free blocks.
-Every block has a word-sized header(4 bytes) where the upper 29 bits are used to encode the block size and since the lower 3 bits will never be used for sizing
+Every block has a word-sized header where the upper bits are used to encode the block size and since the lower 3 bits will never be used for sizing
 (due to the fact that every block size must be 8-byte aligned and therefore must be a multiple of 8 - so we'll never need to use bits that provide more precision 
 than 8 dec = 1000 bin, (2)*8 = 16 dec = 10000 bin ... etc. notice how the last 3 bits will always be unused since they are NOT a multiple of 8 b/c they are all less than 8).
+A word is a size_t - 4 bytes on a 32 bit build and 8 on a 64 bit one - so on a 64 bit build a single block can be bigger than 4 GB.
+Block sizes are multiples of ALIGNMENT (8 or 16, set in config.h) and every payload starts on an ALIGNMENT boundary.
 So we use those bits to convey if a block is allocated or not, where 1 means it is allocated for the LSB and 0 means it is free. 
-The rest of the block after the header is the payload which would contain the actual data and possibly some padding to meet that 8-byte alignment requirement.
-At the end of the block is also a footer which is identical to the header this enables Bi-directional Coalescing discussed in C).
+The rest of the block after the header is the payload which would contain the actual data and possibly some padding to meet that alignment requirement.
+At the end of a FREE block is also a footer which is identical to the header this enables Bi-directional Coalescing discussed in C).
+Allocated blocks don't get a footer - nobody needs to read it. The only reader of a footer is the block right after it, checking whether
+it can coalesce backwards, so instead the second lowest header bit records whether the PREVIOUS block is allocated (the prev-alloc bit)
+and the footer is only consulted when that bit says the previous block is free. That leaves an allocated block with just one word of overhead.
 VISUAL:
        Block Of Memory                                         Header/Footer Block Zoom in: (1/0 LSB - 1 Allocated, 0 Free)
 _____________________________________________                   ________________________________
 |   |                                 |  |   |                 |   |  |  |   |     |     |     |
-| H |    P  A   Y   L   O   A   D     | P| F |                 |1/0| 0| 0|   |BYTE2|BYTE3|BYTE4|
+| H |    P  A   Y   L   O   A   D     | P| F |                 |1/0|1/0| 0|  |BYTE2|BYTE3|BYTE4|
 |___|_________________________________|__| __|                 |___|__|__|___|_____|_____|_____|
     |        Size                     |                        |bitbitbit|# of Bytes/Blocksize |
 H = Header                                                     |   BYTE 1   |                  |
-P = Padding
-F = Footer
-
-B) Search Mechanism to find a Free Block  - First Fit Heap Search(IMPLEMENTATION DETAILS AT METHOD)
-We use a first fit heap search algorithm to find free blocks to allocate - it simply searches the heap from the beginning until it find an appropriate free block.
-it has the advantage that it leaves large free blocks towards the end of the heap so it scores some points with reducing fragmentation. A disadvantage is that the 
-start of the list becomes littered with allocated and freed blocks so the search time for a larger free block takes longer. In my opinion it achieves a good balance of 
-memory utilization and speed(througput) for an implicit list implementation. the alternative would be Next Fit or Best Fit.
+P = Padding                                                     LSB = allocated, next bit = previous block allocated
+F = Footer (free blocks only)
+
+B) Search Mechanism to find a Free Block  - Segregated Explicit Free Lists(IMPLEMENTATION DETAILS AT METHOD)
+Walking every block of the heap on each malloc (the implicit list first fit we started with) makes allocation cost grow linearly with the
+number of blocks in the heap, allocated or not. Instead every FREE block is linked into one of NUM_CLASSES doubly linked lists (bins), one per
+power-of-two size class: bin 0 holds blocks of up to 31 bytes, bin 1 holds 32-63 bytes, ... and the last bin holds everything bigger.
+Since a free block has no payload to protect, the first two words of its payload are reused to store the links:
+_____________________________________________
+|   |      |      |                   |   |
+| H | PRED | SUCC |   (unused)        | F |
+|___|______|______|___________________|___|
+The links are stored as word-sized offsets from the start of the heap (0 means NULL - nothing ever lives at offset 0), so the smallest
+block is four words: header, pred, succ and footer (16 bytes on a 32 bit build, 32 on a 64 bit one). The heads of the bins live at the very start of the heap, before the prologue.
+To find a fit we go to the bin of the requested size and do a first fit search of that bin, and if it comes up empty we move up to the next
+bin, where every block is guaranteed to be big enough. New free blocks are pushed to the front of their bin (LIFO) so free is constant time.
+
+The bins only cover blocks smaller than TREE_MIN. Large free blocks are where first fit really hurts - on traces that interleave small and
+large blocks it happily carves a small request out of the first big block it sees and the big requests that come later no longer fit.
+So every free block of TREE_MIN bytes or more goes into a treap (a binary search tree that is also a heap on a per-node priority) ordered
+by size and then by address. The treap uses the same two link words as the bins (LEFT and RIGHT instead of PRED and SUCC), and the
+priority is a hash of the block's address so it costs no space at all. Random priorities keep the tree balanced in expectation, so
+finding the BEST fit - the smallest block that is big enough, lowest address on ties - is an O(log n) walk down from the root.
 
 C) Policies to maximize memory utilization - Immediate  Bi-directioanl Coalescing(IMPLEMENTATION DETAILS AT METHOD)
 Coalescing is the act of joining adjacent free blocks into one larger free block. The goal is to be aware of the size of our contiguous free blocks in order to more optimally allocate.
@@ -42,16 +62,66 @@ We coalesce after every free operation(this is why it is immediate) to make sure
 
                                            -Immediate Splitting(IMPLEMENTATION DETAILS IN METHOD "PLACE")
 whenever we allocate we always(immediate) split the block if the free block has more space then we need. this also maximizes memory utiiization by decreasing internal fragmentation.
+
+D) Tiny requests - Slab Runs(IMPLEMENTATION DETAILS AT "Slab run functions")
+Requests of RUN_MAX (64) bytes or less don't get a block of their own. Even without a footer a 8 byte request costs a MIN_BLOCK block, and
+tiny requests are the most common ones. Instead we carve RUN_SIZE aligned pages (runs) out of the heap as ordinary allocated blocks and
+cut each one into equal slots of one size class (ALIGNMENT, 2*ALIGNMENT, ..., 64 bytes) with no per-slot header at all:
+_________________________________________________________________
+|      |       |      |      |        |      |      |     |      |
+| SIZE | NFREE | NEXT | PREV | BITMAP | SLOT | SLOT | ... | SLOT |
+|______|_______|______|______|________|______|______|_____|______|
+^ RUN_SIZE aligned
+A set bit in the bitmap means the slot is free, so malloc finds a slot with a single find-first-set on the first non-zero bitmap word.
+Runs with at least one free slot are kept on a list per class. Because a run owns its whole page, free can tell a slot from a block with
+one lookup in runPages (a flag per page of the heap) and find the run header by masking off the low bits of the pointer.
+A run is a whole page though, so a class with only a handful of live slots would waste most of it. So a class only gets a new run once
+there is real demand for it: we count the live tiny requests that had to be served by normal blocks (per block size), and only once
+those blocks add up to a page do we carve a run - at that point the run costs no more than the blocks it replaces. A run that becomes empty goes straight back to the heap as a normal free block.
+
+E) calloc - Known-zero blocks(IMPLEMENTATION DETAILS AT "heap_calloc")
+Memory we get from mem_sbrk is always zero (memlib zeroes whatever the brk gives up), and a big calloc that lands in fresh heap
+would be wasting its time clearing it again. So the third lowest header bit (ZERO) marks a free block whose payload is known to be
+all zero, apart from its two link words and its footer. extend_heap sets it, splitting a known-zero block (place, place_aligned)
+passes it on to both halves, and coalescing keeps it only if every block merged is known-zero - zeroing the headers, footers and
+links that end up inside the merged block. A freed block never gets it, we don't know what the program left in there.
+
+F) Deferred coalescing - Fast bins(IMPLEMENTATION DETAILS AT "Fast bin functions")
+Coalescing on every free reads and writes the boundary tags of both neighbours, and then the very next malloc of the same
+size splits the merged block right back up - that's the common pattern of request/response style programs.
+So a freed block of FAST_MAX bytes or less isn't coalesced at all. It goes onto a fast bin, one LIFO list per block size,
+linked through the first word of its payload, and it stays allocated as far as the rest of the heap is concerned - its
+neighbours don't coalesce with it, the next block's prev-alloc bit stays set. A malloc that needs exactly that block size
+pops it back off in O(1) without touching anything else. Allocated headers never carry the known-zero bit, so the same bit
+(FAST) marks a block that sits on a fast bin.
+Blocks nobody asks for again would just be fragmentation though, so the fast bins are consolidated - every block on them
+freed and coalesced for real - whenever a request finds no fit (before we grow the heap for it), before a large request
+looks for its best fit, when a block of FAST_CONSOLIDATE bytes or more is freed, and whenever the fast bins hold more
+than 1/FAST_FRACTION of the arena's heap.
+
+G) Heap growth(IMPLEMENTATION DETAILS AT "grow_size")
+When nothing fits we have to extend the heap, and with a real sbrk or mmap every extension is a system call. Growing by a
+fixed CHUNKSIZE means a phase that allocates a lot of new memory makes one of those for every couple of mallocs. So the
+amount we grow by adapts: an extension that comes within GROW_WINDOW searches of the last one means we are in such a burst,
+and the next extension is twice as big, up to GROW_MAX and 1/GROW_FRACTION of the heap (so the unused tail never costs much
+utilization). Once extensions are rare again it drops back to CHUNKSIZE. If the last block of the heap is free we only ever
+ask for what it lacks, the rest of it is already there - and so does a realloc that grows the last block in place, any
+slack after it would just be carved up by the next mallocs.
  */
 
+#define _GNU_SOURCE /* for sched_getcpu */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -110,45 +180,410 @@ team_t team = {
 
 /* Basic constants and macros from the book */
 
-#define WSIZE 4 /* Word and header/footer size (bytes) */
-#define DSIZE 8 /* Double word size (bytes) */
-#define CHUNKSIZE (1<<8) /* Extend heap by this amount (bytes) */
+#define WSIZE sizeof(size_t) /* Word and header/footer size (bytes) */
+#define DSIZE (2*WSIZE) /* Double word size (bytes) */
+#define CHUNKSIZE (1<<8) /* Extend heap by at least this amount (bytes)... */
+#define GROW_MAX (1<<15) /* ...and, however busy things get, at most this much or 1/GROW_FRACTION of the heap */
+#define GROW_FRACTION 16
+#define GROW_WINDOW 1024 /* Extensions fewer than this many searches apart double the amount we extend by */
+#define TRIM_THRESHOLD (1<<17) /* Give a free block at the end of the heap back to the OS once it is this big... */
+#define TRIM_KEEP (1<<15) /* ...all but this many bytes of it, so the next few mallocs don't have to grow the heap again */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+
+/* rounds up to the nearest multiple of ALIGNMENT (8 or 16, from config.h) */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p) (* (unsigned int *)(p))
-#define PUT(p, val) (*(unsigned int *)(p) = (val))
+#define GET(p) (* (size_t *)(p))
+#define PUT(p, val) (*(size_t *)(p) = (val))
 
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p) (GET(p) & ~0x7)
+#define GET_SIZE(p) (GET(p) & ~(size_t)0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
-/* Given block ptr bp, compute address of its header and footer */
+/* The prev-alloc bit: set in a header when the block before it is allocated (and so has no footer) */
+#define PREV_ALLOC 0x2
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+/*
+The block whose header this is can be allocated, and a thread without the lock may be reading its size
+(usable_size), so the new header goes in with one atomic store - a plain mov, but the compiler can't tear it.
+*/
+#define SET_PREV_ALLOC(p) __atomic_store_n((size_t *)(p), GET(p) | PREV_ALLOC, __ATOMIC_RELAXED)
+#define CLEAR_PREV_ALLOC(p) __atomic_store_n((size_t *)(p), GET(p) & ~(size_t)PREV_ALLOC, __ATOMIC_RELAXED)
+
+/* The known-zero bit: set in the header and footer of a free block whose payload is all zero except its link words and footer */
+#define ZERO 0x4
+#define GET_ZERO(p) (GET(p) & ZERO)
+
+/* The fast bit: the same bit in the header of an allocated block - set when the block sits on a fast bin */
+#define FAST ZERO
+#define GET_FAST(p) (GET(p) & FAST)
+
+/* Given block ptr bp, compute address of its header and footer (only free blocks have one) */
 #define HDRP(bp) ((char *) (bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks - PREV_BLKP reads the previous footer so only use it when that block is free */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
-static char* firstBlock = 0; //ptr to the first block in the list - starts at the prologue block
+/* Segregated free list constants and macros */
+
+#define NUM_CLASSES 6 /* Number of size class bins - bin i holds blocks of 2^(i+4) to 2^(i+5)-1 bytes */
+#define TREE_MIN (1 << (NUM_CLASSES + 4)) /* Free blocks this big or bigger live in the treap instead of a bin */
+#define MIN_BLOCK ALIGN(2*DSIZE) /* Smallest block: header, pred, succ and footer */
+
+/* Convert between a block ptr and its offset from the start of the heap (offset 0 is NULL) */
+#define TO_OFFSET(bp) ((bp) ? (size_t)((char *)(bp) - heapBase) : 0)
+#define TO_PTR(off) ((off) ? heapBase + (off) : NULL)
+
+/* Given free block ptr bp, compute address of its pred and succ link words */
+#define PREDP(bp) ((char *)(bp))
+#define SUCCP(bp) ((char *)(bp) + WSIZE)
+
+/* Given free block ptr bp, compute the previous and next free blocks in its bin */
+#define PRED_FREEP(bp) TO_PTR(GET(PREDP(bp)))
+#define SUCC_FREEP(bp) TO_PTR(GET(SUCCP(bp)))
+
+/* Address of the word holding the head of bin i */
+#define BINP(i) (binBase + (i) * WSIZE)
+
+/* Given free block ptr bp in the treap, compute address of its left and right child link words */
+#define LEFTP(bp) ((char *)(bp))
+#define RIGHTP(bp) ((char *)(bp) + WSIZE)
+#define LEFT(bp) TO_PTR(GET(LEFTP(bp)))
+#define RIGHT(bp) TO_PTR(GET(RIGHTP(bp)))
+
+/* Address of the word holding the root of the treap - it sits right after the bin heads */
+#define ROOTP (binBase + NUM_CLASSES * WSIZE)
+
+/* Slab run constants and macros */
+
+#define RUN_SHIFT 12
+#define RUN_SIZE (1 << RUN_SHIFT) /* A run is one RUN_SIZE aligned page of equal sized slots */
+#define RUN_MAX 64 /* Requests of up to this many bytes are served from runs */
+#define NUM_RUN_CLASSES (RUN_MAX / ALIGNMENT) /* Slot sizes ALIGNMENT, 2*ALIGNMENT, ..., RUN_MAX */
+#define WBITS (8 * WSIZE) /* Bits in a word */
+#define RUN_MAP_WORDS (RUN_SIZE / ALIGNMENT / WBITS) /* Occupancy bitmap words - one bit per slot of the smallest class */
+#define RUN_HDR ALIGN((4 + RUN_MAP_WORDS) * WSIZE) /* Run header: slot size, free slots, next run, prev run, bitmap */
+#define RUN_NSLOTS(sz) ((RUN_SIZE - WSIZE - RUN_HDR) / (sz)) /* The page's last word is the next block's header */
+
+/* Given any address p in the heap, compute its run (page) and whether that page is a run */
+#define RUN_OF(p) ((char *)((uintptr_t)(p) & ~(uintptr_t)(RUN_SIZE - 1)))
+#define PAGE_INDEX(p) (((uintptr_t)(p) >> RUN_SHIFT) - ((uintptr_t)heap->modelBase >> RUN_SHIFT))
+#define IS_RUN(p) (heap->runPages[PAGE_INDEX(p)])
+
+/* Given run ptr r, compute the address of its header fields, bitmap word i, and slot i */
+#define RUN_SLOTSIZEP(r) ((char *)(r))
+#define RUN_NFREEP(r) ((char *)(r) + WSIZE)
+#define RUN_NEXTP(r) ((char *)(r) + 2*WSIZE)
+#define RUN_PREVP(r) ((char *)(r) + 3*WSIZE)
+#define RUN_MAPP(r, i) ((char *)(r) + (4 + (i)) * WSIZE)
+#define RUN_SLOTP(r, i) ((char *)(r) + RUN_HDR + (i) * GET(RUN_SLOTSIZEP(r)))
+
+/* Address of the word holding the head of the list of runs of class c that still have a free slot */
+#define RUN_HEADP(c) (binBase + (NUM_CLASSES + 1 + (c)) * WSIZE)
+
+/* Address of the word counting the live tiny requests served by normal blocks of asize bytes (MIN_BLOCK to DEMAND_MAX) */
+#define DEMAND_MAX (RUN_MAX + ALIGNMENT) /* The biggest block a tiny request can get */
+#define NUM_DEMANDS ((DEMAND_MAX - MIN_BLOCK) / ALIGNMENT + 1)
+#define RUN_DEMANDP(asize) (binBase + (NUM_CLASSES + 1 + NUM_RUN_CLASSES + ((asize) - MIN_BLOCK) / ALIGNMENT) * WSIZE)
+
+/* Fast bin constants and macros */
+
+#define FAST_MAX 48 /* Freed blocks of up to this many bytes go onto a fast bin instead of being coalesced */
+#define NUM_FAST ((FAST_MAX - MIN_BLOCK) / ALIGNMENT + 1) /* One fast bin per block size MIN_BLOCK, ..., FAST_MAX */
+#define FAST_FRACTION 64 /* Consolidate once the fast bins hold more than 1/FAST_FRACTION of the heap... */
+#define FAST_CONSOLIDATE (1<<16) /* ...or a block at least this big is freed */
+
+/* Address of the word holding the head of the fast bin for blocks of asize bytes - after the demand counters */
+#define FASTP(asize) (binBase + (NUM_CLASSES + 1 + NUM_RUN_CLASSES + NUM_DEMANDS + ((asize) - MIN_BLOCK) / ALIGNMENT) * WSIZE)
+
+/* Given block ptr bp on a fast bin, compute the address of its link to the next block on that bin */
+#define FAST_NEXTP(bp) ((char *)(bp))
+
+/* An arena is a heap of its own, growing in its own region of the memory model, with its own bins, treap, runs and lock */
+typedef struct {
+    pthread_mutex_t lock; //guards everything in the arena, see "Thread-safe entry points"
+    int region; //the memlib region it grows in
+    char *firstBlock;
+    char *heapBase;
+    char *binBase;
+    char *remote; //blocks other threads freed into the arena, see remote_push - not guarded by the lock...
+    size_t remoteCount; //...and about how many there are
+    char *runLo; //the first and last byte of all the pages that were ever runs in this heap (so mm_init
+    char *runHi; //only has to clear those flags in runPages) - runLo is NULL until there is a run
+    mm_stats_t stats; //the counters mm_stats adds up, kept up to date under the lock as things happen
+    unsigned int binSizes[TREE_MIN / ALIGNMENT]; //how many blocks of each size are on the bins, so largest_free needn't walk them
+    size_t growSize; //how much to extend the heap by when nothing fits, see grow_size
+    size_t searches; //find_block calls so far...
+    size_t lastGrow; //...and how many there had been at the last extension
+} arena_t;
+
+#if MM_FREE_CLASSES != NUM_CLASSES + 1
+#error "mm_stats counts a free block class per bin and one for the treap"
+#endif
+
+/*
+A heap context: the arenas of one heap and the memory model they grow in. Every thread works on one (the
+default heap, unless it picked another with mm_heap_use), so heaps made by mm_heap_create are completely
+independent of each other and of the default one, and different threads can use them at the same time.
+*/
+struct mm_heap {
+    arena_t arenas[MAX_ARENAS];
+    int numArenas;
+    int arenaPolicy;
+    size_t arenaSpan; //bytes from the start of one region to the start of the next
+    unsigned int nextArena; //the arena the next thread gets with MM_ARENA_RR
+    unsigned int gen; //the heap generation mm_init gave it, see "Thread-safe entry points"
+    char *modelBase; //ptr to the first byte of the whole memory model (every arena's region)
+    unsigned char *runPages; //one flag per page of the memory model - is this page a run?
+    mem_t *mem; //the memory model, NULL for the one mem_init set up
+};
+
+static unsigned char defaultRunPages[MAX_HEAP / RUN_SIZE + 1];
+static mm_heap_t defaultHeap = {.numArenas = 1, .arenaPolicy = MM_ARENA_RR, .runPages = defaultRunPages};
+static __thread mm_heap_t *heap = &defaultHeap; //the heap of this thread
+/*
+The arena everything below works on - the one whose lock this thread holds - and copies of its pointers,
+so the macros don't have to go through it. lock_arena() sets them.
+*/
+static __thread arena_t *arena = 0;
+static __thread char* firstBlock = 0; //ptr to the first block in the list - starts at the prologue block
+static __thread char* heapBase = 0; //ptr to the first byte of the heap - all the free list links are offsets from here
+static __thread char* binBase = 0; //ptr to the NUM_CLASSES bin heads (and the treap root and run lists) that live at the start of the heap
+
+/* Free list helper functions */
+
+/*
+size_class - return the index of the bin that holds free blocks of the given size.
+bin i holds sizes in [2^(i+4), 2^(i+5)), so we just find the highest set bit.
+Only blocks smaller than TREE_MIN live on a bin.
+*/
+static int size_class(size_t size)
+{
+    int i = 0;
+
+    size >>= 5;//anything under 32 bytes lives in bin 0
+    while (size > 0 && i < NUM_CLASSES - 1) {
+        size >>= 1;
+        i++;
+    }
+    return i;
+}
+
+/*
+Treap helper functions - every one of them works on offsets-turned-pointers of free blocks
+that are TREE_MIN or bigger and returns the new root of the subtree it was handed.
+Careful: TO_OFFSET evaluates its argument twice, so results of the recursive calls go through a local first.
+*/
+
+/* tree_priority - the heap priority of a treap node, a hash of its offset (the murmur3 finalizer) */
+static unsigned int tree_priority(char *bp)
+{
+    unsigned int x = (unsigned int)TO_OFFSET(bp);//the low 32 bits are plenty to tell nodes apart
+
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
+
+/* tree_less - the treap is ordered by size, and by address between blocks of the same size */
+static int tree_less(char *a, char *b)
+{
+    size_t asize = GET_SIZE(HDRP(a));
+    size_t bsize = GET_SIZE(HDRP(b));
+
+    return asize < bsize || (asize == bsize && a < b);
+}
+
+/* tree_split - split the subtree t into the nodes ordered before bp (*l) and the rest (*r) */
+static void tree_split(char *t, char *bp, char **l, char **r)
+{
+    char *sub;
+
+    if (t == NULL) {
+        *l = *r = NULL;
+    }
+    else if (tree_less(t, bp)) {
+        tree_split(RIGHT(t), bp, &sub, r);
+        PUT(RIGHTP(t), TO_OFFSET(sub));
+        *l = t;
+    }
+    else {
+        tree_split(LEFT(t), bp, l, &sub);
+        PUT(LEFTP(t), TO_OFFSET(sub));
+        *r = t;
+    }
+}
+
+/* tree_merge - join two subtrees where every node of l is ordered before every node of r */
+static char *tree_merge(char *l, char *r)
+{
+    char *sub;
+
+    if (l == NULL) {
+        return r;
+    }
+    if (r == NULL) {
+        return l;
+    }
+    if (tree_priority(l) > tree_priority(r)) {
+        sub = tree_merge(RIGHT(l), r);
+        PUT(RIGHTP(l), TO_OFFSET(sub));
+        return l;
+    }
+    sub = tree_merge(l, LEFT(r));
+    PUT(LEFTP(r), TO_OFFSET(sub));
+    return r;
+}
+
+/* tree_insert - insert bp below t, it becomes the root of the first subtree it outranks */
+static char *tree_insert(char *t, char *bp)
+{
+    char *l, *r, *sub;
+
+    if (t == NULL || tree_priority(bp) > tree_priority(t)) {
+        tree_split(t, bp, &l, &r);
+        PUT(LEFTP(bp), TO_OFFSET(l));
+        PUT(RIGHTP(bp), TO_OFFSET(r));
+        return bp;
+    }
+    if (tree_less(bp, t)) {
+        sub = tree_insert(LEFT(t), bp);
+        PUT(LEFTP(t), TO_OFFSET(sub));
+    }
+    else {
+        sub = tree_insert(RIGHT(t), bp);
+        PUT(RIGHTP(t), TO_OFFSET(sub));
+    }
+    return t;
+}
+
+/* tree_remove - remove bp from below t by merging its two children in its place */
+static char *tree_remove(char *t, char *bp)
+{
+    char *sub;
+
+    if (t == bp) {
+        return tree_merge(LEFT(t), RIGHT(t));
+    }
+    if (tree_less(bp, t)) {
+        sub = tree_remove(LEFT(t), bp);
+        PUT(LEFTP(t), TO_OFFSET(sub));
+    }
+    else {
+        sub = tree_remove(RIGHT(t), bp);
+        PUT(RIGHTP(t), TO_OFFSET(sub));
+    }
+    return t;
+}
+
+/* tree_best_fit - the smallest (then lowest) block in the treap that holds asize bytes, NULL if none does */
+static char *tree_best_fit(size_t asize)
+{
+    char *t = TO_PTR(GET(ROOTP));
+    char *best = NULL;
+
+    while (t != NULL) {
+        if (GET_SIZE(HDRP(t)) >= asize) {//t fits - but maybe something smaller on its left does too
+            best = t;
+            t = LEFT(t);
+        }
+        else {
+            t = RIGHT(t);
+        }
+    }
+    return best;
+}
+
+/*
+largest_free - size of the biggest free block: the end of the treap's right spine, or else the biggest size the bins
+hold a block of. The bins are unsorted, so that comes from the arena's count of blocks of each size - at most
+TREE_MIN / ALIGNMENT of them to look at, however many blocks there are.
+*/
+static size_t largest_free(void)
+{
+    char *t = TO_PTR(GET(ROOTP));
+    size_t i;
+
+    if (t != NULL) {
+        while (RIGHT(t) != NULL) {
+            t = RIGHT(t);
+        }
+        return GET_SIZE(HDRP(t));
+    }
+    for (i = TREE_MIN / ALIGNMENT - 1; i > 0 && arena->binSizes[i] == 0; i--)
+        ;
+    return i * ALIGNMENT;
+}
+
+/* insert_free_block - push a free block onto the front of its bin (LIFO), or into the treap if it is a large one */
+static void insert_free_block(void *bp)
+{
+    char *binp;
+    char *head;
+    size_t size = GET_SIZE(HDRP(bp));
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+    arena->stats.free_bytes += size;
+    arena->stats.free_blocks[size >= TREE_MIN ? NUM_CLASSES : size_class(size)]++;
+    if (size >= TREE_MIN) {
+        head = tree_insert(TO_PTR(GET(ROOTP)), bp);
+        PUT(ROOTP, TO_OFFSET(head));
+        return;
+    }
+    arena->binSizes[size / ALIGNMENT]++;
+    binp = BINP(size_class(size));
+    head = TO_PTR(GET(binp));
+
+    PUT(PREDP(bp), 0);
+    PUT(SUCCP(bp), TO_OFFSET(head));
+    if (head != NULL) {
+        PUT(PREDP(head), TO_OFFSET(bp));
+    }
+    PUT(binp, TO_OFFSET(bp));
+}
 
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+/* remove_free_block - unlink a free block from its bin or the treap, it must be called before the block's size changes */
+static void remove_free_block(void *bp)
+{
+    char *pred;
+    char *succ;
+    size_t size = GET_SIZE(HDRP(bp));
 
+    arena->stats.free_bytes -= size;
+    arena->stats.free_blocks[size >= TREE_MIN ? NUM_CLASSES : size_class(size)]--;
+    if (size >= TREE_MIN) {
+        succ = tree_remove(TO_PTR(GET(ROOTP)), bp);//the new root
+        PUT(ROOTP, TO_OFFSET(succ));
+        return;
+    }
+    arena->binSizes[size / ALIGNMENT]--;
+    pred = PRED_FREEP(bp);
+    succ = SUCC_FREEP(bp);
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+    if (pred != NULL) {
+        PUT(SUCCP(pred), TO_OFFSET(succ));
+    }
+    else {//bp was the head of its bin
+        PUT(BINP(size_class(size)), TO_OFFSET(succ));
+    }
+    if (succ != NULL) {
+        PUT(PREDP(succ), TO_OFFSET(pred));
+    }
+}
 
 /*A heap checker that checks for the invariants of our Dynamic Memory Allocator
 as it is an Implicit Free List Implementation with bidirectional coalescing we
-will check if each block is 8-Byte aligned, the header and footer matches, if
+will check if each block is 8-Byte aligned, the header and footer of free blocks match, if
 there are any adjacent free blocks. In addition we will check for the special 
 edge case blocks of the prologue and epilogue blocks that was provided by the book
 as a clever trick to avoid repeated testing for the beginning and end of heap
@@ -158,37 +593,288 @@ which is accurate and allows appropriate traversal and a LSB of 1 so it is not c
 and remains a border for the heap. As for the Epilogue block it acts as the border for
 the end of the heap and signals its existence with having a size of 0 which is solely to 
 signal to processes manipulating the heap where the end is. It too has a LSB of 1 to avoid 
-coalescing*/
-int mm_check(void) {
-    /*check the prologue header - make sure every time it has the form 0x009 which is 1001 in bin*/
-    unsigned int* pHeader = (unsigned int*)HDRP(firstBlock);
-    unsigned int* pFooter = (unsigned int*)FTRP(firstBlock);
-    if (*pHeader != *pFooter || GET_SIZE(pHeader) != 8 || !GET_ALLOC(pHeader)) {
-        printf("Prologue Header violates heap invariant - prologue is of form \n________________\n|               |\n|%x       %x |  \n", GET(HDRP(firstBlock)), GET(FTRP(firstBlock)));
+coalescing
+
+On top of the block invariants we check the segregated free lists: every block on a bin
+must be free, belong to that bin's size class, have links that point inside the heap
+(mem_region_lo() to mem_region_hi() of the arena's region) and agree with its neighbours' links. Every free block
+found while walking the heap must be on its bin, and the bins must hold exactly as many
+blocks as the heap has free blocks - so each free block is on exactly one bin.
+The treap gets the same treatment through check_tree, which also checks that it is still
+ordered by (size, address) and that no child outranks its parent.
+Runs are checked by check_run: the run block has to start on its page, the free count has to
+match the bitmap, and a run has to be on its class list exactly when it has a free slot.
+Blocks on fast bins are allocated blocks with the FAST bit, and it works the same way as the bins:
+every block on a fast bin must have the bit and the bin's size, and every block with the bit must
+be on the fast bin for its size - so the fast bins hold exactly the blocks the walk found with it.*/
+
+/* check_run - check the header of run r, counting it in *partial if it has a free slot */
+static int check_run(char *r, size_t *partial) {
+    size_t sz = GET(RUN_SLOTSIZEP(r));
+    size_t nfree = 0;
+    size_t word;
+    int i;
+
+    if (r != RUN_OF(r) || sz == 0 || sz > RUN_MAX || sz % ALIGNMENT != 0) {
+        printf("run %p is misaligned or has a bogus slot size %lu\n", r, (unsigned long)sz);
+        return 0;
+    }
+    for (i = 0; i < RUN_MAP_WORDS; i++) {
+        for (word = GET(RUN_MAPP(r, i)); word != 0; word &= word - 1) {
+            if (WBITS * i + __builtin_ffsl(word) - 1 >= RUN_NSLOTS(sz)) {
+                printf("run %p marks slot %lu free but only has %lu slots\n", r, (unsigned long)(WBITS * i + __builtin_ffsl(word) - 1), (unsigned long)RUN_NSLOTS(sz));
+                return 0;
+            }
+            nfree++;
+        }
+    }
+    if (nfree != GET(RUN_NFREEP(r))) {
+        printf("run %p says it has %lu free slots but its bitmap has %lu\n", r, (unsigned long)GET(RUN_NFREEP(r)), (unsigned long)nfree);
+        return 0;
+    }
+    if (nfree > 0) {
+        (*partial)++;
+    }
+    return 1;
+}
+
+/* check_tree - check the treap below t, whose nodes must all sort between lo and hi (NULL = unbounded) */
+static int check_tree(char *t, char *lo, char *hi, size_t *count, size_t max) {
+    if (t == NULL) {
+        return 1;
+    }
+    if (t < (char *)mem_region_lo(arena->region) || t > (char *)mem_region_hi(arena->region)) {
+        printf("treap points outside the heap: %p is not in (%p:%p)\n", t, mem_region_lo(arena->region), mem_region_hi(arena->region));
+        return 0;
+    }
+    if (GET_ALLOC(HDRP(t)) || GET_SIZE(HDRP(t)) < TREE_MIN) {
+        printf("block %p (header %lx) does not belong in the treap\n", t, (unsigned long)GET(HDRP(t)));
+        return 0;
+    }
+    if ((lo != NULL && !tree_less(lo, t)) || (hi != NULL && !tree_less(t, hi))) {
+        printf("treap node %p of size %lu is out of order\n", t, (unsigned long)GET_SIZE(HDRP(t)));
+        return 0;
+    }
+    if ((LEFT(t) != NULL && tree_priority(LEFT(t)) > tree_priority(t)) ||
+        (RIGHT(t) != NULL && tree_priority(RIGHT(t)) > tree_priority(t))) {
+        printf("a child of treap node %p outranks it\n", t);
+        return 0;
+    }
+    if (++(*count) > max) {//also stops us from going around a cycle forever
+        printf("treap holds more blocks than the %lu free blocks in the heap\n", (unsigned long)max);
+        return 0;
+    }
+    return check_tree(LEFT(t), lo, t, count, max) && check_tree(RIGHT(t), t, hi, count, max);
+}
+
+/* check_zero - is the payload of free block bp zero everywhere but its two link words? */
+static int check_zero(char *bp) {
+    char *p;
+
+    for (p = bp + 2*WSIZE; p < FTRP(bp); p += WSIZE) {
+        if (GET(p) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* heap_check - check every invariant of the current arena (mm_check runs it on every arena) */
+static int heap_check(void) {
+    /*check the prologue header - make sure every time it has the form 0x009 which is 1001 in bin (0x011 on a 64 bit build)*/
+    size_t* pHeader = (size_t*)HDRP(firstBlock);
+    size_t* pFooter = (size_t*)FTRP(firstBlock);
+    if (*pHeader != *pFooter || GET_SIZE(pHeader) != DSIZE || !GET_ALLOC(pHeader)) {
+        printf("Prologue Header violates heap invariant - prologue is of form \n________________\n|               |\n|%lx       %lx |  \n", (unsigned long)GET(HDRP(firstBlock)), (unsigned long)GET(FTRP(firstBlock)));
         return 0;//error
     }
-    /*check all the blocks in the heap - are they 8-byte aligned? does the header and footer match? 
-    are their any contiguous free blocks? is of the form 0xXXX9 OR 0xXXX8*/
+    /*check all the blocks in the heap - are they ALIGNMENT aligned? does the header and footer of free blocks match? 
+    does the prev-alloc bit agree with the block before? are their any contiguous free blocks? is of the form 0xXXX9 OR 0xXXX8*/
     void* bp;
+    size_t heapFree = 0;//number of free blocks found walking the heap
+    size_t prevAlloc = PREV_ALLOC;//the prologue is allocated
+    size_t runs = 0;//number of runs found walking the heap
+    size_t partialRuns = 0;//how many of them have a free slot
+    size_t heapFast = 0;//number of blocks with the fast bit found walking the heap
     //note the iteration through the heap implicitly checks if the epilogue block's size is set to 0 by making it the exit condition
     for (bp = firstBlock; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-        if (GET_SIZE(HDRP(bp)) % 8 != 0) {
-            printf("not 8-byte aligned, the size is %d", GET_SIZE(HDRP(bp)));
+        if (bp != firstBlock && (GET_SIZE(HDRP(bp)) % ALIGNMENT != 0 || (uintptr_t)bp % ALIGNMENT != 0)) {//the prologue is just two words
+            printf("not %d-byte aligned, the block is at %p and the size is %lu", ALIGNMENT, bp, (unsigned long)GET_SIZE(HDRP(bp)));
+                return 0;
+        }
+        if (!GET_ALLOC(HDRP(bp)) && GET(HDRP(bp)) != GET(FTRP(bp))) {
+            printf("header != footer: The header is %lx\nThe footer is %lx", (unsigned long)GET(HDRP(bp)), (unsigned long)GET(FTRP(bp)));
+                return 0;
+        }
+        if (GET_ZERO(HDRP(bp)) && !GET_ALLOC(HDRP(bp)) && !check_zero(bp)) {
+            printf("block %p has the known-zero bit but is not all zero\n", bp);
+            return 0;
+        }
+        if (GET_FAST(HDRP(bp)) && GET_ALLOC(HDRP(bp))) {
+            /*on allocated blocks that bit means it is on a fast bin - the one for its size*/
+            char *fp;
+            size_t n = 0;
+            if (GET_SIZE(HDRP(bp)) > FAST_MAX || IS_RUN(bp)) {
+                printf("block %p (size %lu) has the fast bit but can't be on a fast bin\n", bp, (unsigned long)GET_SIZE(HDRP(bp)));
                 return 0;
+            }
+            for (fp = TO_PTR(GET(FASTP(GET_SIZE(HDRP(bp))))); fp != NULL && fp != bp && n <= arena->stats.fast_blocks; fp = TO_PTR(GET(FAST_NEXTP(fp))), n++)
+                ;
+            if (fp != bp) {
+                printf("block %p has the fast bit but is not on the fast bin for size %lu\n", bp, (unsigned long)GET_SIZE(HDRP(bp)));
+                return 0;
+            }
+            heapFast++;
+        }
+        if (bp != firstBlock && GET_PREV_ALLOC(HDRP(bp)) != prevAlloc) {//nothing comes before the prologue
+            printf("prev-alloc bit of %p is %d but the previous block is %s\n", bp, GET_PREV_ALLOC(HDRP(bp)) != 0, prevAlloc ? "allocated" : "free");
+            return 0;
         }
-        if (GET(HDRP(bp)) != GET(FTRP(bp))) {
-            printf("header != footer: The header is %x\nThe footer is %x", GET(HDRP(bp)), GET(FTRP(bp)));
+        prevAlloc = GET_ALLOC(HDRP(bp)) ? PREV_ALLOC : 0;
+        if (GET_ALLOC(HDRP(bp)) && IS_RUN(bp)) {
+            if (!check_run(bp, &partialRuns)) {
                 return 0;
+            }
+            runs++;
         }
         if (GET_SIZE(HDRP(NEXT_BLKP(bp))) > 0 && !GET_ALLOC(HDRP(bp)) && !GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
             printf("contiguous free blocks - violation of immediate Bi-directional coalescing invariant");
         }
+        if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+            /*this free block has to be in the treap, right where a search for it would go*/
+            char *fp = TO_PTR(GET(ROOTP));
+            while (fp != NULL && fp != bp) {
+                fp = tree_less(bp, fp) ? LEFT(fp) : RIGHT(fp);
+            }
+            if (fp == NULL) {
+                printf("free block %p (size %lu) is not in the treap\n", bp, (unsigned long)GET_SIZE(HDRP(bp)));
+                return 0;
+            }
+            heapFree++;
+        }
+        else if (!GET_ALLOC(HDRP(bp))) {
+            /*this free block has to be on the bin for its size*/
+            char *fp;
+            for (fp = TO_PTR(GET(BINP(size_class(GET_SIZE(HDRP(bp)))))); fp != NULL && fp != bp; fp = SUCC_FREEP(fp))
+                ;
+            if (fp == NULL) {
+                printf("free block %p (size %lu) is not on bin %d\n", bp, (unsigned long)GET_SIZE(HDRP(bp)), size_class(GET_SIZE(HDRP(bp))));
+                return 0;
+            }
+            heapFree++;
+        }
     }
     /*check if the epilogue block's LSB is set to 1 as it should if not it violates invariant*/
-    if (!GET_ALLOC(HDRP(bp))) {
+    if (!GET_ALLOC(HDRP(bp)) || GET_PREV_ALLOC(HDRP(bp)) != prevAlloc) {
         printf("epilogue block messed up");
         return 0;
     }
+
+    /*check every bin - is every block on it free, in the right bin, in the heap, and linked both ways?*/
+    size_t listFree = 0;//number of blocks found walking the bins
+    unsigned int binSizes[TREE_MIN / ALIGNMENT] = {0};//and how many of each size
+    int i;
+    for (i = 0; i < NUM_CLASSES; i++) {
+        char *fp;
+        char *pred = NULL;
+        for (fp = TO_PTR(GET(BINP(i))); fp != NULL; pred = fp, fp = SUCC_FREEP(fp)) {
+            if (fp < (char *)mem_region_lo(arena->region) || fp > (char *)mem_region_hi(arena->region)) {
+                printf("bin %d points outside the heap: %p is not in (%p:%p)\n", i, fp, mem_region_lo(arena->region), mem_region_hi(arena->region));
+                return 0;
+            }
+            if (GET_ALLOC(HDRP(fp))) {
+                printf("allocated block %p is on bin %d\n", fp, i);
+                return 0;
+            }
+            if (GET_SIZE(HDRP(fp)) >= TREE_MIN || size_class(GET_SIZE(HDRP(fp))) != i) {
+                printf("block %p of size %lu is on bin %d instead of bin %d\n", fp, (unsigned long)GET_SIZE(HDRP(fp)), i, size_class(GET_SIZE(HDRP(fp))));
+                return 0;
+            }
+            if (PRED_FREEP(fp) != pred) {
+                printf("pred link of %p is %p but the block before it on bin %d is %p\n", fp, PRED_FREEP(fp), i, pred);
+                return 0;
+            }
+            if (++listFree > heapFree) {//also stops us from going around a cycle forever
+                printf("bins hold more blocks than the %lu free blocks in the heap - a block is on more than one bin or a bin has a cycle\n", (unsigned long)heapFree);
+                return 0;
+            }
+            binSizes[GET_SIZE(HDRP(fp)) / ALIGNMENT]++;
+        }
+    }
+    if (memcmp(binSizes, arena->binSizes, sizeof(binSizes)) != 0) {
+        printf("the bins don't hold as many blocks of each size as the arena's counts say\n");
+        return 0;
+    }
+    if (!check_tree(TO_PTR(GET(ROOTP)), NULL, NULL, &listFree, heapFree)) {
+        return 0;
+    }
+    if (listFree != heapFree) {
+        printf("bins and treap hold %lu blocks but the heap has %lu free blocks\n", (unsigned long)listFree, (unsigned long)heapFree);
+        return 0;
+    }
+
+    /*check the fast bins - only allocated blocks of the bin's size with the fast bit, and as many as the counters say*/
+    size_t listFast = 0;
+    size_t fastBytes = 0;
+    size_t asize;
+    for (asize = MIN_BLOCK; asize <= FAST_MAX; asize += ALIGNMENT) {
+        char *fp;
+        for (fp = TO_PTR(GET(FASTP(asize))); fp != NULL; fp = TO_PTR(GET(FAST_NEXTP(fp)))) {
+            if (fp < (char *)mem_region_lo(arena->region) || fp > (char *)mem_region_hi(arena->region)) {
+                printf("fast bin for size %lu points outside the heap: %p is not in (%p:%p)\n", (unsigned long)asize, fp, mem_region_lo(arena->region), mem_region_hi(arena->region));
+                return 0;
+            }
+            if (!GET_ALLOC(HDRP(fp)) || !GET_FAST(HDRP(fp)) || GET_SIZE(HDRP(fp)) != asize) {
+                printf("block %p (header %lx) does not belong on the fast bin for size %lu\n", fp, (unsigned long)GET(HDRP(fp)), (unsigned long)asize);
+                return 0;
+            }
+            fastBytes += asize;
+            if (++listFast > heapFast) {//also stops us from going around a cycle forever
+                printf("fast bins hold more than the %lu blocks with the fast bit - a block is on one twice or a fast bin has a cycle\n", (unsigned long)heapFast);
+                return 0;
+            }
+        }
+    }
+    if (listFast != heapFast || listFast != arena->stats.fast_blocks || fastBytes != arena->stats.fast_bytes) {
+        printf("%lu blocks with the fast bit, %lu on the fast bins (%lu bytes), but the counters say %lu (%lu bytes)\n",
+               (unsigned long)heapFast, (unsigned long)listFast, (unsigned long)fastBytes,
+               (unsigned long)arena->stats.fast_blocks, (unsigned long)arena->stats.fast_bytes);
+        return 0;
+    }
+
+    /*check the run lists - only runs of the right class with a free slot, and every such run*/
+    size_t listRuns = 0;
+    size_t pages = 0;
+    for (i = 0; i < NUM_RUN_CLASSES; i++) {
+        char *r;
+        char *prev = NULL;
+        for (r = TO_PTR(GET(RUN_HEADP(i))); r != NULL; prev = r, r = TO_PTR(GET(RUN_NEXTP(r)))) {
+            if (r < (char *)mem_region_lo(arena->region) || r > (char *)mem_region_hi(arena->region) || !IS_RUN(r)) {
+                printf("run list %d points at %p which is not a run\n", i, r);
+                return 0;
+            }
+            if (GET(RUN_SLOTSIZEP(r)) != (size_t)(i + 1) * ALIGNMENT || GET(RUN_NFREEP(r)) == 0) {
+                printf("run %p (slot size %lu, %lu free) does not belong on run list %d\n", r, (unsigned long)GET(RUN_SLOTSIZEP(r)), (unsigned long)GET(RUN_NFREEP(r)), i);
+                return 0;
+            }
+            if (TO_PTR(GET(RUN_PREVP(r))) != prev) {
+                printf("prev link of run %p is wrong\n", r);
+                return 0;
+            }
+            if (++listRuns > partialRuns) {
+                printf("run lists hold more than the %lu runs with a free slot\n", (unsigned long)partialRuns);
+                return 0;
+            }
+        }
+    }
+    for (i = PAGE_INDEX(mem_region_lo(arena->region)); i <= (int)PAGE_INDEX(mem_region_hi(arena->region)); i++) {
+        pages += heap->runPages[i];
+    }
+    if (listRuns != partialRuns || pages != runs) {
+        printf("%lu runs with a free slot but %lu on the run lists, %lu runs but %lu run pages\n",
+               (unsigned long)partialRuns, (unsigned long)listRuns, (unsigned long)runs, (unsigned long)pages);
+        return 0;
+    }
     return 1;//all invariants remain
 
 }
@@ -199,50 +885,89 @@ int mm_check(void) {
 /*
 place the requested block at the beginning of the free block, splitting only if
 the size of the remainder would equal or exceed the minimum block size.
+The free block comes off its bin and the remainder (if any) goes onto the bin for its own size.
 */
 static void place(void *bp, size_t asize)
 {
     size_t csize = GET_SIZE(HDRP(bp));//get the size of the free block
     size_t remainder = csize - asize;//get the extra space in # of bytes that is not needed to store requested block: Freeblock Size - Allocation size
+    size_t zero = GET_ZERO(HDRP(bp));//allocated headers never carry the known-zero bit, only the remainder can inherit it
+
+    remove_free_block(bp);
     
     //ensures the remainder of free slots is big enough to be its own free slot
-    if (remainder >= (2 * DSIZE)) {//16 bytes - 2 for hdr, ftr and something else for free space which needs to be at least 8 to align it
-        //allocate the requested block
-        PUT(HDRP(bp), PACK(asize, 1));//set its header
-        PUT(FTRP(bp), PACK(asize, 1));//setits footer
+    if (remainder >= MIN_BLOCK) {//hdr, ftr and room for the pred and succ links
+        //allocate the requested block - allocated blocks have no footer
+        PUT(HDRP(bp), PACK(asize, 1) | GET_PREV_ALLOC(HDRP(bp)));//set its header
 
         //SPLITTING - put us in position to split - right after the allocated block
+        arena->stats.splits++;
         bp = NEXT_BLKP(bp);
-        //The remainder of unneeded space becomes a free block
-        PUT(HDRP(bp), PACK(remainder, 0));
-        PUT(FTRP(bp), PACK(remainder, 0));
+        //The remainder of unneeded space becomes a free block, whose previous block is the one we just allocated
+        //it was all payload of a known-zero block (apart from the footer it keeps) so it is known-zero too
+        PUT(HDRP(bp), PACK(remainder, 0) | PREV_ALLOC | zero);
+        PUT(FTRP(bp), PACK(remainder, 0) | PREV_ALLOC | zero);
+        insert_free_block(bp);
     }
     else {
         //no need to split - not enough free bytes left over - just allocate it to the free block
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT(HDRP(bp), PACK(csize, 1) | GET_PREV_ALLOC(HDRP(bp)));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));//tell the next block it can't coalesce with us anymore
     }
 }
 
-//find_fit from book Ch9 
-static void* find_fit(size_t asize)
+/*
+adjust_size - the block size needed for a payload of size bytes: the payload plus
+the header (allocated blocks have no footer), rounded up to keep ALIGNMENT alignment,
+and never below MIN_BLOCK since the block has to hold its links and footer once it is freed
+*/
+static size_t adjust_size(size_t size)
 {
-/* First-fit search */
-    void* bp;//pointer that will iterate through the heap
+    if (size <= MIN_BLOCK - WSIZE){//anything this small fits in the smallest block
+        return MIN_BLOCK;
+    }
+    return ALIGN(size + WSIZE);//pad it
+}
 
-    /*start at the beginning and go from block to block until we find a free block that has the appropriate size
-      or until we reach the epilogue block*/
-    for (bp = firstBlock; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
-            return bp;
+/*
+find_fit - segregated fit: first fit on the bin for asize, then move up the bins.
+only the first bin we look at can hold blocks that are too small, every bin above
+it only holds blocks at least twice the smallest size of asize's bin.
+Large requests, and small ones that every bin turned down, get the best fit from the treap.
+*/
+static void* find_fit(size_t asize)
+{
+    int i;
+    char* bp;//pointer that will iterate through the bins
+
+    if (asize < TREE_MIN) {
+        for (i = size_class(asize); i < NUM_CLASSES; i++) {
+            for (bp = TO_PTR(GET(BINP(i))); bp != NULL; bp = SUCC_FREEP(bp)) {
+                if (asize <= GET_SIZE(HDRP(bp))) {
+                    return bp;
+                }
+            }
         }
     }
-    //reached epilogue block - just return NULL - there is no kosher location for this requested block size
-    return NULL; /* No fit */
+    //NULL if even the treap has nothing - there is no kosher location for this requested block size
+    return tree_best_fit(asize);
 }
 
 
 
+/*
+clear_seam - free block bp is being merged into a known-zero block, so the words that made it a block
+of its own (the footer before it, its header and its two links) become payload and have to be zeroed.
+Every other word of bp is already zero, or it wouldn't have the known-zero bit.
+*/
+static void clear_seam(char *bp)
+{
+    PUT(HDRP(bp) - WSIZE, 0);
+    PUT(HDRP(bp), 0);
+    PUT(PREDP(bp), 0);
+    PUT(SUCCP(bp), 0);
+}
+
 /*
 An application frees a previously allocated block by calling the mm_free function (Figure 9.46), which
 frees the requested block ( bp ) and then merges adjacent free blocks using the boundary-tags
@@ -254,22 +979,36 @@ prologue and epilogue blocks that are always marked as allocated—allows us to
 troublesome edge conditions where the requested block bp is at the beginning or end of the heap.
 Without these special blocks, the code would be messier, more error prone, and slower because we
 would have to check for these rare edge conditions on each and every free request.
+
+bp must not be on a bin yet. Any free neighbour is taken off its bin before it is merged (its size is
+about to change) and the coalesced block is inserted on the bin for its final size.
+The caller must already have cleared the prev-alloc bit of the block after bp. The block before a free
+block is always allocated (otherwise they would have been coalesced) so every coalesced block keeps PREV_ALLOC.
 */
 
 static void *coalesce(void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));//only go looking for the previous footer if that block is free
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
+    char *prev = prev_alloc ? NULL : PREV_BLKP(bp);
+    char *next = NEXT_BLKP(bp);
+    //the coalesced block is known-zero only if every block that goes into it is
+    size_t zero = (GET_ZERO(HDRP(bp)) && (prev_alloc || GET_ZERO(HDRP(prev))) && (next_alloc || GET_ZERO(HDRP(next))))? ZERO : 0;
 
     if (prev_alloc && next_alloc) {    /* Case 1 -> both blocks are allocated no need to coalesce */
-        return bp;
+        arena->stats.coalesces[0]++;
     }
 
     else if (prev_alloc && !next_alloc) {    /* Case 2 -> the next block is free - we will combine them */
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));//(size of this free block) + (size of next free block) = (size of coalesced free block)
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT (FTRP(bp), PACK(size,0));
+        arena->stats.coalesces[1]++;
+        remove_free_block(next);
+        size += GET_SIZE(HDRP(next));//(size of this free block) + (size of next free block) = (size of coalesced free block)
+        if (zero) {
+            clear_seam(next);
+        }
+        PUT(HDRP(bp), PACK(size, 0) | PREV_ALLOC | zero);
+        PUT (FTRP(bp), PACK(size,0) | PREV_ALLOC | zero);
     }
 
     /* Whenever we coalesce with a previous block we need to maintain the invariant that 
@@ -277,27 +1016,62 @@ static void *coalesce(void *bp)
     - otherwise it will be left in the middle of a free block effectively making all 
     the above macros useless as they do pointer arithemtic with the assumption that bp is at the start of a block */
     else if (!prev_alloc && next_alloc) {    /* Case 3 -> the previous block is free - we will combine them */
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));//same as in case 2
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);//<-- INVARIANT MAINTAINED
+        arena->stats.coalesces[2]++;
+        remove_free_block(prev);
+        size += GET_SIZE(HDRP(prev));//same as in case 2
+        PUT(FTRP(bp), PACK(size, 0) | PREV_ALLOC | zero);
+        if (zero) {
+            clear_seam(bp);
+        }
+        PUT(HDRP(prev), PACK(size, 0) | PREV_ALLOC | zero);
+        bp = prev;//<-- INVARIANT MAINTAINED
     }
 
     else {     /* Case 4 *///same
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
-        GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);//<-- INVARIANT MAINTAINED
+        arena->stats.coalesces[3]++;
+        remove_free_block(prev);
+        remove_free_block(next);
+        size += GET_SIZE(HDRP(prev)) + GET_SIZE(HDRP(next));
+        PUT(FTRP(next), PACK(size, 0) | PREV_ALLOC | zero);
+        if (zero) {
+            clear_seam(bp);
+            clear_seam(next);
+        }
+        PUT(HDRP(prev), PACK(size, 0) | PREV_ALLOC | zero);
+        bp = prev;//<-- INVARIANT MAINTAINED
     }
+    insert_free_block(bp);
     return bp;
 }
 
+/*
+split_tail - shrink the allocated block bp down to asize bytes, turning the tail into a
+free block if it is big enough to be one. The tail is coalesced, since the block after
+bp might be free, which also puts it on its bin.
+*/
+static void split_tail(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t remainder = csize - asize;
+    char *tail;
+
+    if (remainder < MIN_BLOCK) {//not worth splitting - the tail stays as internal fragmentation
+        return;
+    }
+    PUT(HDRP(bp), PACK(asize, 1) | GET_PREV_ALLOC(HDRP(bp)));
+    tail = NEXT_BLKP(bp);
+    PUT(HDRP(tail), PACK(remainder, 0) | PREV_ALLOC);
+    PUT(FTRP(tail), PACK(remainder, 0) | PREV_ALLOC);
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(tail)));
+    coalesce(tail);
+}
+
 /*
 The extend_heap function is invoked in two different circumstances: (1) when the heap is initialized and
 (2) when mm_malloc is unable to find a suitable fit. To maintain alignment, extend_heap rounds up the
-requested size to the nearest multiple of 2 words (8 bytes) and then requests the additional heap space 
+requested size to the nearest multiple of ALIGNMENT and then requests the additional heap space 
 from the memory system(lines 132-134).
+The new free block ends up on a bin through coalesce.
 */
 
 static void *extend_heap(size_t words)//WILL BE INITIAL HEAP SIZE
@@ -305,109 +1079,563 @@ static void *extend_heap(size_t words)//WILL BE INITIAL HEAP SIZE
     char *bp;
     size_t size;
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+    /* Allocate a multiple of ALIGNMENT to maintain alignment - and never less than a block, it has to hold its links and footer */
+    size = MAX(ALIGN(words * WSIZE), MIN_BLOCK);
     //mem_sbrk returns a pointer to the beginning of the newly added on heap
-    if ((long)(bp = mem_sbrk(size)) == -1){
+    if ((long)(bp = mem_region_sbrk(arena->region, size)) == -1){
         return NULL;
     }
+    arena->stats.extends++;
+    arena->stats.extend_bytes += size;
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0)); /* Free block header *///we destroy extra prologue and make it into header in first call
-    PUT(FTRP(bp), PACK(size, 0)); /* Free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+    //the old epilogue header becomes our header, so it already knows whether the block before us is allocated
+    //memlib zeroes everything past the brk, so the new block is known-zero
+    PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)) | ZERO); /* Free block header *///we destroy extra prologue and make it into header in first call
+    PUT(FTRP(bp), GET(HDRP(bp))); /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header - the block before it is free */
 
     /* Coalesce if the previous block was free */
     return coalesce(bp);//this will turn the old epilogue block into the header or even further back if their is more free space behind epilogue
 }
 
-    /* End of book helper functions */
-
-/* 
- * mm_init - initialize the malloc package.
-
-mm_init: Before calling mm_malloc mm_realloc or mm_free, the application program 
-(i.e.,the trace-driven driver program that you will use to evaluate your implementation) 
-calls mm_init to perform any necessary initializations, such as allocating the initial heap area. 
-The return value shouldbe -1 if there was a problem in performing the initialization, 0 otherwise.
-*/
-
-/*Before calling mm_malloc or mm_free , the application must initialize the heap by calling the mm_init
-function
+static int consolidate(void);//trim_heap empties the fast bins, and emptying them frees blocks, which trims the heap
 
-The mm_init function gets four words from the memory system and initializes them to create the empty
-free list (lines 110-117). It then calls the extend_heap function, which extends the heap by
-CHUNKSIZE bytes and creates the initial free block. At this point, the allocator is initialized and ready to
-accept allocate and free requests from the application.
+/*
+trim_heap -the opposite of extend_heap. If free block bp is the last block of the heap and at least
+TRIM_THRESHOLD bytes, shrink it to TRIM_KEEP bytes and hand the rest back with a negative sbrk - memlib
+gives every whole page of that back to the OS. Without this a heap never gets smaller than it was at
+its peak, however little is allocated now.
+A small block waiting on a fast bin is allocated as far as coalesce is concerned, so one of those between bp and
+the end of the heap (or right below a small bp at the end) would keep it there for good. So before giving up we
+empty the fast bins - the free_block that frees the last of them comes back here with the block it coalesced.
 */
-
-int mm_init(void)
+static void trim_heap(void *bp)
 {
-    firstBlock = mem_sbrk(4 * WSIZE);
-    /* Create the initial empty heap */
-    if (firstBlock == (void *)-1){
-        return -1;
+    size_t size = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+
+    if (GET_SIZE(HDRP(next)) != 0) {
+        if (size >= TRIM_THRESHOLD && GET_FAST(HDRP(next))) {
+            consolidate();
+        }
+        return;
     }
-    PUT(firstBlock, 0); /* Alignment padding */
-    PUT(firstBlock + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
-    PUT(firstBlock + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
-    PUT(firstBlock + (3*WSIZE), PACK(0, 1)); /* Epilogue header */
-    firstBlock += (2*WSIZE);
-    /* Extend the empty heap with a free block of CHUMSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL){
-        return -1;
+    if (size < TRIM_THRESHOLD) {
+        if (arena->stats.fast_blocks != 0 && arena->stats.free_bytes >= TRIM_THRESHOLD) {//there may be a big block below the fast ones
+            consolidate();
+        }
+        return;
     }
-    //mm_check();
-    return 0;
+    remove_free_block(bp);//its size is about to change, and so is where it belongs
+    PUT(HDRP(bp), PACK(TRIM_KEEP, 0) | (GET(HDRP(bp)) & (PREV_ALLOC | ZERO)));
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header - the block before it is free */
+    insert_free_block(bp);
+    mem_region_sbrk(arena->region, -(intptr_t)(size - TRIM_KEEP));
 }
 
-/* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+/* free_block - give an allocated block back to the heap (this is what mm_free does for every block that isn't a run slot) */
+static void free_block(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)));//designate this block as free by setting LSB to 0
+    PUT(FTRP(bp), GET(HDRP(bp)));//free blocks need their footer back
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));//let the next block know it can coalesce with us
+    trim_heap(coalesce(bp));
+}
 
-mm_malloc:The mm_malloc routine returns a pointer to an allocated block payload of at least size bytes. 
-The entire allocated block should lie within the heap region and should not overlap with any other 
-allocated chunk.
+/* Fast bin functions */
 
-We will be comparing your implementation to the version of malloc supplied in the 
-standard C library(libc). Since the libc malloc always returns payload pointers that are aligned to 8 bytes,
- your malloc implementation should do likewise and always return 8-byte aligned pointers.
-*/
+/* fast_push - put the allocated block bp on the fast bin for its size instead of freeing it */
+static void fast_push(char *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
 
-void *mm_malloc(size_t size)
+    PUT(HDRP(bp), GET(HDRP(bp)) | FAST);
+    PUT(FAST_NEXTP(bp), GET(FASTP(size)));
+    PUT(FASTP(size), TO_OFFSET(bp));
+    arena->stats.fast_bytes += size;
+    arena->stats.fast_blocks++;
+}
+
+/* fast_pop - take the newest block off the fast bin for asize bytes, NULL if it is empty. The block is ready to use */
+static char *fast_pop(size_t asize)
 {
-    size_t asize; /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;
-    
+    char *bp = TO_PTR(GET(FASTP(asize)));
 
-    /* Ignore spurious requests */
-    if (size == 0){
+    if (bp == NULL) {
         return NULL;
     }
+    PUT(FASTP(asize), GET(FAST_NEXTP(bp)));
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~(size_t)FAST);
+    arena->stats.fast_bytes -= asize;
+    arena->stats.fast_blocks--;
+    return bp;
+}
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE){//no point in allocating a 8-byte block - only room for header and footer - where's the payload? make it at least 16 - bytes
-        asize = 2*DSIZE;
-    }
-    else {
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);//pad it
+/*
+consolidate - empty every fast bin, freeing (and so coalescing) each block on it. Returns whether there was
+anything to free, so a caller that found no fit knows whether searching again could help.
+Every block comes off its bin before the first one is freed: free_block may trim the heap, and trim_heap may
+consolidate, which then finds the bins empty instead of starting over on the blocks we haven't got to.
+*/
+static int consolidate(void)
+{
+    size_t asize;
+    char *bp;
+    char *next;
+    char *popped = NULL;
+    char *last = NULL;
+
+    if (arena->stats.fast_blocks == 0) {
+        return 0;
+    }
+    arena->stats.consolidations++;
+    for (asize = MIN_BLOCK; asize <= FAST_MAX; asize += ALIGNMENT) {
+        while ((bp = fast_pop(asize)) != NULL) {//in the order they come off, which is the order they get freed in
+            PUT(FAST_NEXTP(bp), 0);
+            if (last != NULL) {
+                PUT(FAST_NEXTP(last), TO_OFFSET(bp));
+            }
+            else {
+                popped = bp;
+            }
+            last = bp;
+        }
     }
+    for (bp = popped; bp != NULL; bp = next) {
+        next = TO_PTR(GET(FAST_NEXTP(bp)));
+        free_block(bp);
+    }
+    return 1;
+}
 
-    /* Search the free list for a fit */
-    (bp = find_fit(asize));
-    if (bp != NULL) {
-        place(bp, asize);
-        //mm_check();
+/*
+fast_free - free the block bp through its fast bin if it is small enough, and consolidate once
+the fast bins have grown past 1/FAST_FRACTION of the heap.
+Freeing a big block consolidates too: a small block waiting on a fast bin right after it would keep
+it from coalescing with what comes after - or from being trimmed, if that is the end of the heap.
+*/
+static void fast_free(char *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t heapSize;
+
+    if (size > FAST_MAX) {
+        free_block(bp);
+        if (size >= FAST_CONSOLIDATE) {
+            consolidate();
+        }
+        return;
+    }
+    fast_push(bp);
+    heapSize = (char *)mem_region_hi(arena->region) + 1 - (char *)mem_region_lo(arena->region);
+    if (arena->stats.fast_bytes > heapSize / FAST_FRACTION) {
+        consolidate();
+    }
+}
+
+    /* End of book helper functions */
+
+/* Aligned allocation functions */
+
+/*
+align_payload - the first payload address at or after bp that is a multiple of align and
+leaves either no gap at all or a gap big enough to be a free block of its own
+*/
+static char *align_payload(char *bp, size_t align)
+{
+    char *a = (char *)(((uintptr_t)bp + align - 1) & ~(uintptr_t)(align - 1));
+
+    while (a != bp && (size_t)(a - bp) < MIN_BLOCK) {//a gap that small can't be a block - skip to the next boundary (align may be less than MIN_BLOCK, so maybe more than once)
+        a += align;
+    }
+    return a;
+}
+
+/* aligned_fits - can the free block bp hold a block of asize bytes with an aligned payload? */
+static int aligned_fits(char *bp, size_t asize, size_t align)
+{
+    return (size_t)(align_payload(bp, align) - bp) + asize <= GET_SIZE(HDRP(bp));
+}
+
+/* tree_aligned_fit - walk the treap in order from the smallest block that could fit, stopping at the first that does */
+static char *tree_aligned_fit(char *t, size_t asize, size_t align)
+{
+    char *bp;
+
+    if (t == NULL) {
+        return NULL;
+    }
+    if (GET_SIZE(HDRP(t)) < asize) {//t and everything on its left is too small
+        return tree_aligned_fit(RIGHT(t), asize, align);
+    }
+    if ((bp = tree_aligned_fit(LEFT(t), asize, align)) != NULL) {
         return bp;
     }
+    if (aligned_fits(t, asize, align)) {
+        return t;
+    }
+    return tree_aligned_fit(RIGHT(t), asize, align);
+}
+
+/* find_aligned_fit - find_fit for a block whose payload must be align aligned */
+static char *find_aligned_fit(size_t asize, size_t align)
+{
+    int i;
+    char *bp;
+
+    if (asize < TREE_MIN) {
+        for (i = size_class(asize); i < NUM_CLASSES; i++) {
+            for (bp = TO_PTR(GET(BINP(i))); bp != NULL; bp = SUCC_FREEP(bp)) {
+                if (aligned_fits(bp, asize, align)) {
+                    return bp;
+                }
+            }
+        }
+    }
+    return tree_aligned_fit(TO_PTR(GET(ROOTP)), asize, align);
+}
+
+/*
+place_aligned - place a block of asize bytes in free block bp so that its payload is align aligned.
+The gap in front of the aligned payload becomes a free block of its own (its previous block is
+allocated, since bp was free, so there is nothing to coalesce) and the rest goes through place().
+*/
+static char *place_aligned(char *bp, size_t asize, size_t align)
+{
+    char *a = align_payload(bp, align);
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t gap = a - bp;
+    size_t zero = GET_ZERO(HDRP(bp));//both halves of a known-zero block are known-zero
+
+    if (gap > 0) {
+        remove_free_block(bp);
+        PUT(HDRP(bp), PACK(gap, 0) | GET_PREV_ALLOC(HDRP(bp)) | zero);
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        insert_free_block(bp);
+        PUT(HDRP(a), PACK(csize - gap, 0) | zero);//the block before it is the free gap
+        PUT(FTRP(a), GET(HDRP(a)));
+        insert_free_block(a);
+    }
+    place(a, asize);
+    return a;
+}
+
+/*
+alloc_aligned - allocate a block of asize bytes whose payload is align aligned. When nothing fits we
+extend the heap by just enough to fit the block at the first aligned spot after the last block (or
+inside it, if the last block is free).
+*/
+static char *alloc_aligned(size_t asize, size_t align)
+{
+    char *bp;
+    char *epilogue;
+    size_t lastFree = 0; //size of the free block at the end of the heap, if there is one
+
+    if ((bp = find_aligned_fit(asize, align)) != NULL ||
+        (consolidate() && (bp = find_aligned_fit(asize, align)) != NULL)) {//the fast bins might have been in the way
+        return place_aligned(bp, asize, align);
+    }
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);
-    bp = extend_heap(extendsize/WSIZE);
-    if (bp == NULL){
+    epilogue = (char *)mem_region_hi(arena->region) + 1;//the payload ptr of the epilogue, which is where a new block starts
+    bp = epilogue;
+    if (!GET_PREV_ALLOC(HDRP(epilogue))) {//the new space will coalesce with the free block before it
+        lastFree = GET_SIZE(HDRP(epilogue) - WSIZE);
+        bp = epilogue - lastFree;
+    }
+    if (extend_heap((align_payload(bp, align) - bp + asize - lastFree) / WSIZE) == NULL) {
         return NULL;
     }
-    place(bp, asize);
+    return place_aligned(bp, asize, align);
+}
+
+/* Slab run functions */
+
+/* run_link - push run r onto the front of the list of runs of class c with a free slot */
+static void run_link(char *r, int c)
+{
+    char *head = TO_PTR(GET(RUN_HEADP(c)));
+
+    PUT(RUN_PREVP(r), 0);
+    PUT(RUN_NEXTP(r), TO_OFFSET(head));
+    if (head != NULL) {
+        PUT(RUN_PREVP(head), TO_OFFSET(r));
+    }
+    PUT(RUN_HEADP(c), TO_OFFSET(r));
+}
+
+/* run_unlink - take run r off the list of runs of class c with a free slot */
+static void run_unlink(char *r, int c)
+{
+    char *prev = TO_PTR(GET(RUN_PREVP(r)));
+    char *next = TO_PTR(GET(RUN_NEXTP(r)));
+
+    if (prev != NULL) {
+        PUT(RUN_NEXTP(prev), TO_OFFSET(next));
+    }
+    else {
+        PUT(RUN_HEADP(c), TO_OFFSET(next));
+    }
+    if (next != NULL) {
+        PUT(RUN_PREVP(next), TO_OFFSET(prev));
+    }
+}
+
+/* new_run - carve a new run for class c out of the heap with every slot free */
+static char *new_run(int c)
+{
+    size_t sz = (c + 1) * ALIGNMENT;
+    size_t nslots = RUN_NSLOTS(sz);
+    size_t i;
+    char *r;
+
+    if ((r = alloc_aligned(RUN_SIZE, RUN_SIZE)) == NULL) {
+        return NULL;
+    }
+    IS_RUN(r) = 1;
+    if (arena->runLo == NULL || r < arena->runLo) {
+        arena->runLo = r;
+    }
+    if (r + RUN_SIZE - 1 > arena->runHi) {
+        arena->runHi = r + RUN_SIZE - 1;
+    }
+    PUT(RUN_SLOTSIZEP(r), sz);
+    PUT(RUN_NFREEP(r), nslots);
+    for (i = 0; i < RUN_MAP_WORDS; i++) {//set one bit per slot that exists
+        if (nslots >= WBITS * (i + 1)) {
+            PUT(RUN_MAPP(r, i), ~(size_t)0);
+        }
+        else if (nslots > WBITS * i) {
+            PUT(RUN_MAPP(r, i), ((size_t)1 << (nslots - WBITS * i)) - 1);
+        }
+        else {
+            PUT(RUN_MAPP(r, i), 0);
+        }
+    }
+    run_link(r, c);
+    return r;
+}
+
+/*
+count_demand - a normal block of size bytes serving a tiny request came (delta 1) or went (delta -1).
+Blocks are counted by their real size, so the same block always lands in the same counter - which is
+why this takes the block size and not the request size. Frees of blocks that were never counted
+(a 72 byte block serving a 68 byte request, say) just stop at 0.
+*/
+static void count_demand(size_t size, int delta)
+{
+    if (size <= DEMAND_MAX && (delta > 0 || GET(RUN_DEMANDP(size)) > 0)) {
+        PUT(RUN_DEMANDP(size), GET(RUN_DEMANDP(size)) + delta);
+    }
+}
+
+/*
+run_malloc - take the first free slot of the first run of the class that fits size bytes.
+Returns NULL when the class has no run with a free slot and not enough demand for a new one
+(or no memory for it), in which case the caller serves the request with a normal block.
+*/
+static void *run_malloc(size_t size)
+{
+    int c = (size - 1) / ALIGNMENT;
+    char *r = TO_PTR(GET(RUN_HEADP(c)));
+    size_t asize = adjust_size(size);
+    size_t word;
+    int i;
+
+    if (r == NULL && (GET(RUN_DEMANDP(asize)) * asize < RUN_SIZE || (r = new_run(c)) == NULL)) {
+        return NULL;
+    }
+    for (i = 0; GET(RUN_MAPP(r, i)) == 0; i++)//a run on the list always has a free slot
+        ;
+    word = GET(RUN_MAPP(r, i));
+    PUT(RUN_MAPP(r, i), word & (word - 1));//clear the lowest set bit - the slot we are taking
+    PUT(RUN_NFREEP(r), GET(RUN_NFREEP(r)) - 1);
+    if (GET(RUN_NFREEP(r)) == 0) {//full - nothing left to find here
+        run_unlink(r, c);
+    }
+    return RUN_SLOTP(r, WBITS * i + __builtin_ffsl(word) - 1);
+}
+
+/* run_free - mark the slot at p free again, giving its run back to the heap once it is empty */
+static void run_free(void *p)
+{
+    char *r = RUN_OF(p);
+    size_t sz = GET(RUN_SLOTSIZEP(r));
+    int c = sz / ALIGNMENT - 1;
+    size_t slot = ((char *)p - r - RUN_HDR) / sz;
+    size_t nfree = GET(RUN_NFREEP(r)) + 1;
+
+    PUT(RUN_MAPP(r, slot / WBITS), GET(RUN_MAPP(r, slot / WBITS)) | ((size_t)1 << (slot % WBITS)));
+    PUT(RUN_NFREEP(r), nfree);
+    if (nfree == 1) {//it was full, so it wasn't on its list
+        run_link(r, c);
+    }
+    if (nfree == RUN_NSLOTS(sz)) {
+        run_unlink(r, c);
+        IS_RUN(r) = 0;
+        free_block(r);
+    }
+}
+
+/* 
+ * mm_init - initialize the malloc package.
+
+mm_init: Before calling mm_malloc mm_realloc or mm_free, the application program 
+(i.e.,the trace-driven driver program that you will use to evaluate your implementation) 
+calls mm_init to perform any necessary initializations, such as allocating the initial heap area. 
+The return value shouldbe -1 if there was a problem in performing the initialization, 0 otherwise.
+*/
+
+/*Before calling mm_malloc or mm_free , the application must initialize the heap by calling the mm_init
+function
+
+The mm_init function gets four words from the memory system and initializes them to create the empty
+free list (lines 110-117). It then calls the extend_heap function, which extends the heap by
+CHUNKSIZE bytes and creates the initial free block. At this point, the allocator is initialized and ready to
+accept allocate and free requests from the application.
+
+In front of those four words we also grab room for the NUM_CLASSES bin heads, the treap root, the
+NUM_RUN_CLASSES run lists and their demand counters, and the NUM_FAST fast bins, which all start out empty.
+This sets up the current arena in its own region - mm_init runs it once for every arena.
+
+heap_init, heap_malloc, heap_free and heap_realloc are the bodies of mm_init, mm_malloc, mm_free and mm_realloc -
+the caller holds the lock of the current arena (see "Thread-safe entry points").
+*/
+
+static int heap_init(void)
+{
+    int i;
+
+    heapBase = binBase = mem_region_sbrk(arena->region, ALIGN((NUM_CLASSES + 1 + NUM_RUN_CLASSES + NUM_DEMANDS + NUM_FAST) * WSIZE));
+    if (binBase == (void *)-1){
+        return -1;
+    }
+    for (i = 0; i < NUM_CLASSES; i++) {
+        PUT(BINP(i), 0); /* Empty bin */
+    }
+    PUT(ROOTP, 0); /* Empty treap */
+    for (i = 0; i < NUM_RUN_CLASSES; i++) {
+        PUT(RUN_HEADP(i), 0); /* No runs */
+    }
+    for (i = 0; i < NUM_DEMANDS; i++) {
+        PUT(RUN_DEMANDP(MIN_BLOCK + i * ALIGNMENT), 0); /* and no demand for them yet */
+    }
+    for (i = 0; i < NUM_FAST; i++) {
+        PUT(FASTP(MIN_BLOCK + i * ALIGNMENT), 0); /* Empty fast bin */
+    }
+    firstBlock = mem_region_sbrk(arena->region, 4 * WSIZE);
+    /* Create the initial empty heap */
+    if (firstBlock == (void *)-1){
+        return -1;
+    }
+    PUT(firstBlock, 0); /* Alignment padding */
+    PUT(firstBlock + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
+    PUT(firstBlock + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+    PUT(firstBlock + (3*WSIZE), PACK(0, 1) | PREV_ALLOC); /* Epilogue header */
+    firstBlock += (2*WSIZE);
+    /* Extend the empty heap with a free block of CHUMSIZE bytes */
+    if (extend_heap(CHUNKSIZE/WSIZE) == NULL){
+        return -1;
+    }
+    //mm_check();
+    return 0;
+}
+
+/* 
+ * mm_malloc - Allocate a block by incrementing the brk pointer.
+ *     Always allocate a block whose size is a multiple of the alignment.
+
+mm_malloc:The mm_malloc routine returns a pointer to an allocated block payload of at least size bytes. 
+The entire allocated block should lie within the heap region and should not overlap with any other 
+allocated chunk.
+
+We will be comparing your implementation to the version of malloc supplied in the 
+standard C library(libc). Since the libc malloc always returns payload pointers that are aligned to 8 bytes,
+ your malloc implementation should do likewise and always return 8-byte aligned pointers.
+*/
+
+/*
+grow_size - how much to extend the heap by for a request nothing could fit. Twice as much as last time if the last
+extension was fewer than GROW_WINDOW searches ago (within the GROW_MAX and GROW_FRACTION caps), CHUNKSIZE if it wasn't.
+*/
+static size_t grow_size(void)
+{
+    size_t heapSize = (char *)mem_region_hi(arena->region) + 1 - (char *)mem_region_lo(arena->region);
+    size_t cap = MAX(MIN(GROW_MAX, heapSize / GROW_FRACTION), CHUNKSIZE);
+
+    if (arena->searches - arena->lastGrow < GROW_WINDOW) {
+        arena->growSize = MIN(2 * arena->growSize, cap);
+    }
+    else {
+        arena->growSize = CHUNKSIZE;
+    }
+    arena->lastGrow = arena->searches;
+    return arena->growSize;
+}
+
+/* find_block - a free block of at least asize bytes, from the free lists if one fits and from a heap extension otherwise */
+static char *find_block(size_t asize)
+{
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;
+    char *epilogue;
+
+    arena->searches++;
+
+    /*
+    Search the free list for a fit - and once more after consolidating, if the fast bins had anything to give back.
+    A large request gets the best fit, which it can only find once the small blocks around the big ones are coalesced.
+    */
+    if (asize >= TREE_MIN) {
+        consolidate();
+    }
+    if ((bp = find_fit(asize)) != NULL || (consolidate() && (bp = find_fit(asize)) != NULL)) {
+        return bp;
+    }
+    /* No fit found. Get more memory - as much as grow_size says, or just what the last block lacks if it is free */
+    extendsize = MAX(asize, grow_size());
+    epilogue = (char *)mem_region_hi(arena->region) + 1;
+    if (!GET_PREV_ALLOC(HDRP(epilogue))) {//the last block is free (trim_heap leaves one)
+        extendsize = asize - GET_SIZE(HDRP(epilogue) - WSIZE);
+    }
+    return extend_heap(extendsize/WSIZE);
+}
+
+static void *heap_malloc(size_t size)
+{
+    size_t asize; /* Adjusted block size */
+    char *bp;
+    
+
+    /* Ignore spurious requests - and ones that could never fit in the heap (adjusting those would wrap around) */
+    if (size == 0 || size > MAX_HEAP){
+        return NULL;
+    }
+
+    /* Tiny requests go to a slot in a run - fall through to a normal block only if we couldn't get a run */
+    if (size <= RUN_MAX && (bp = run_malloc(size)) != NULL) {
+        arena->stats.live_bytes += GET(RUN_SLOTSIZEP(RUN_OF(bp)));
+        return bp;
+    }
+
+    /* Adjust block size to include overhead and alignment reqs. */
+    asize = adjust_size(size);
+
+    /* Reuse a block of exactly this size off its fast bin, or find a free block and place the block in it */
+    if (asize <= FAST_MAX && (bp = fast_pop(asize)) != NULL) {
+        arena->stats.live_bytes += asize - WSIZE;
+    }
+    else {
+        if ((bp = find_block(asize)) == NULL){
+            return NULL;
+        }
+        place(bp, asize);
+        arena->stats.live_bytes += GET_SIZE(HDRP(bp)) - WSIZE;
+    }
+    if (size <= RUN_MAX) {//a tiny request that didn't get a slot - it counts towards a run for its size
+        count_demand(GET_SIZE(HDRP(bp)), 1);
+    }
 
     //mm_check();
     return bp;
@@ -423,13 +1651,16 @@ passed pointer (ptr) was returned by an earlier call to
 mm_malloc or mm_realloc and has not yet been freed
 */
 
-void mm_free(void *ptr)
+static void heap_free(void *ptr)
 {
-    
-    size_t size = GET_SIZE(HDRP(ptr));
-    PUT(HDRP(ptr), PACK(size, 0));//designate this block as free by setting LSB to 0
-    PUT(FTRP(ptr), PACK(size, 0));//same
-    coalesce(ptr);
+    if (IS_RUN(ptr)) {//a slot in a run - it has no header of its own
+        arena->stats.live_bytes -= GET(RUN_SLOTSIZEP(RUN_OF(ptr)));
+        run_free(ptr);
+        return;
+    }
+    arena->stats.live_bytes -= GET_SIZE(HDRP(ptr)) - WSIZE;
+    count_demand(GET_SIZE(HDRP(ptr)), -1);
+    fast_free(ptr);
     //mm_check();
     return;
 }
@@ -437,7 +1668,7 @@ void mm_free(void *ptr)
 
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_realloc - Resize in place whenever the neighbourhood allows it, copy only as a last resort
 
 mmrealloc:The mm_realloc routine returns a pointer to an allocated region of at least 
 size bytes with the following constraints.
@@ -455,36 +1686,839 @@ For example, if the old block is 8 bytes and the new block is 12 bytes, then the
 block are identical to the first 8 bytes of the old block and the last 4 bytes are uninitialized. 
 Similarly, if the old block is 8 byte sand the new block is 4 bytes, then the contents of the new block are 
 identical to the first 4 bytes of the old block.
+
+We try the cheap options first, none of which copy a single byte:
+    1) Shrinking - the block already fits, split the tail off into a free block (split_tail).
+    2) Growing into the next block - if the next block is free and old size + its size is enough,
+       take it off its bin and absorb it, splitting off whatever we don't need.
+    3) Growing at the end of the heap - if the block is the last one (maybe followed by a free block
+       that is too small) we extend the heap by only the missing bytes and absorb that like in 2).
+Only when all of these fail do we fall back to mm_malloc + memcpy + mm_free.
 */
 
-void *mm_realloc(void *ptr, size_t size)
+static void *heap_realloc(void *ptr, size_t size)
 {
-    void *oldptr = ptr;
-    void *newptr;
+    size_t asize; /* Adjusted block size */
+    size_t oldsize;
+    size_t avail; /* Bytes we can reach without moving: this block plus a free successor */
     size_t copySize;
-    
-    newptr = mm_malloc(size);
+    char *next;
+    void *newptr;
+
+    if (ptr == NULL) {
+        return heap_malloc(size);
+    }
+    if (size == 0) {
+        heap_free(ptr);
+        return NULL;
+    }
+    if (size > MAX_HEAP) {//could never fit - leave the old block alone
+        return NULL;
+    }
+
+    /* A slot can't grow or shrink - keep it if the new size still fits, otherwise move */
+    if (IS_RUN(ptr)) {
+        oldsize = GET(RUN_SLOTSIZEP(RUN_OF(ptr)));
+        if (size <= oldsize) {
+            arena->stats.realloc_shrinks++;
+            return ptr;
+        }
+        if ((newptr = heap_malloc(size)) == NULL) {
+            return NULL;
+        }
+        memcpy(newptr, ptr, oldsize);
+        heap_free(ptr);
+        arena->stats.realloc_moves++;
+        return newptr;
+    }
+
+    asize = adjust_size(size);
+    oldsize = GET_SIZE(HDRP(ptr));
+    if (asize == oldsize) {
+        arena->stats.realloc_shrinks++;
+        return ptr;
+    }
+
+    /* 1) Shrink in place */
+    if (asize < oldsize) {
+        count_demand(oldsize, -1);
+        split_tail(ptr, asize);
+        arena->stats.live_bytes -= oldsize - GET_SIZE(HDRP(ptr));
+        arena->stats.realloc_shrinks++;
+        return ptr;
+    }
+
+    next = NEXT_BLKP(ptr);
+    if (GET_ALLOC(HDRP(next)) && GET_FAST(HDRP(next)) && consolidate()) {//the block after us is only waiting on a fast bin - free it for real
+        next = NEXT_BLKP(ptr);
+    }
+    avail = oldsize;
+    if (!GET_ALLOC(HDRP(next))) {
+        avail += GET_SIZE(HDRP(next));
+    }
+
+    /* 3) We are at the end of the heap - only ask the memory system for the shortfall */
+    if (avail < asize && (GET_SIZE(HDRP(next)) == 0 ||
+                          (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0))) {
+        if (extend_heap((asize - avail) / WSIZE) == NULL) {
+            return NULL;
+        }
+        next = NEXT_BLKP(ptr);//the new space coalesced with the free block after us (if there was one)
+        avail = oldsize + GET_SIZE(HDRP(next));
+    }
+
+    /* 2) Grow in place by absorbing the free block after us */
+    if (avail >= asize) {
+        count_demand(oldsize, -1);
+        remove_free_block(next);
+        PUT(HDRP(ptr), PACK(avail, 1) | GET_PREV_ALLOC(HDRP(ptr)));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+        split_tail(ptr, asize);
+        arena->stats.live_bytes += GET_SIZE(HDRP(ptr)) - oldsize;
+        arena->stats.realloc_grows++;
+        return ptr;
+    }
+
+    /* No room around the block - move it */
+    newptr = heap_malloc(size);
     if (newptr == NULL){
       return NULL;
     }
-    copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
+    copySize = oldsize - WSIZE;//the old payload
     if (size < copySize){
         copySize = size;
-        memcpy(newptr, oldptr, copySize);
-        mm_free(oldptr);
-        return newptr;
     }
+    memcpy(newptr, ptr, copySize);
+    heap_free(ptr);
+    arena->stats.realloc_moves++;
+    return newptr;
+}
+
+/*
+heap_memalign - the body of mm_memalign: a block of size bytes whose payload is a multiple of align.
+Alignments mm_malloc gives anyway are just a malloc. Otherwise alloc_aligned finds a free block with
+room for the aligned payload, the slack in front of it goes back as a free block of its own and the
+rest is placed like any other block, so nothing is wasted on over-allocating.
+*/
+static void *heap_memalign(size_t align, size_t size)
+{
+    char *bp;
+
+    if (size == 0 || size > MAX_HEAP || align > MAX_HEAP) {
+        return NULL;
+    }
+    if (align <= ALIGNMENT) {
+        return heap_malloc(size);
+    }
+    if ((bp = alloc_aligned(adjust_size(size), align)) != NULL) {
+        arena->stats.live_bytes += GET_SIZE(HDRP(bp)) - WSIZE;
+    }
+    return bp;
+}
+
+/*
+heap_calloc - the body of mm_calloc: a block of size bytes, with *zeroed set if its payload is already all zero.
+A block carved out of a known-zero free block only has to have the words that held the free block's links
+(the first two of the payload) and its footer (the last word of the payload, unless place split it off) cleared.
+Tiny requests are just a malloc - a slot is never known-zero and the memset is cheap anyway.
+*/
+static void *heap_calloc(size_t size, int *zeroed)
+{
+    size_t asize;
+    size_t zero;
+    char *bp;
+
+    *zeroed = 0;
+    if (size <= RUN_MAX || size > MAX_HEAP) {
+        return heap_malloc(size);
+    }
+    asize = adjust_size(size);
+    if ((bp = find_block(asize)) == NULL) {
+        return NULL;
+    }
+    zero = GET_ZERO(HDRP(bp));
+    place(bp, asize);
+    arena->stats.live_bytes += GET_SIZE(HDRP(bp)) - WSIZE;
+    if (zero) {
+        PUT(PREDP(bp), 0);
+        PUT(SUCCP(bp), 0);
+        PUT(bp + GET_SIZE(HDRP(bp)) - DSIZE, 0);
+        *zeroed = 1;
+        arena->stats.calloc_zeroed++;
+    }
+    return bp;
+}
+
+/* Thread-safe entry points */
+
+/*
+Everything above works on the current arena and runs with that arena's lock held. There are numArenas
+arenas (mm_arenas sets how many, 1 unless told otherwise), each one a heap of its own in its own region
+of the memory model, so threads working in different arenas never wait for each other - not even in
+mem_sbrk, since every region has its own brk.
+A thread mallocs from its own arena. Threads either take arenas round robin, in the order they first
+malloc (MM_ARENA_RR), or use the arena of the CPU they are running on right now (MM_ARENA_CPU).
+If that arena is out of memory we try the others before giving up.
+A block can be freed by any thread though, so free has to find the arena a block came from. The regions
+are all the same size and lie back to back, so that is just the block's distance from the start of the
+memory model divided by the size of a region (ARENA_OF).
+
+Taking a lock on every call would still make the threads of an arena take turns, so in front of the arenas
+every thread keeps a small cache of the blocks it freed recently: one LIFO list per payload size class
+(ALIGNMENT, 2*ALIGNMENT, ..., CACHE_MAX bytes). A cached block is still allocated as far as its arena is
+concerned - the first word of its payload just links it to the next cached block - so a thread that frees
+and mallocs blocks of the same size never touches a lock.
+A cached block can't coalesce with anything though, and on a small heap a few cached blocks are a
+lot of fragmentation. So free only caches a block when its arena's lock is busy - when nobody else is in
+the arena the block goes straight back, and a single threaded program never caches anything at all.
+A block lands on the class of the payload it really has (rounded down) and a request looks in the
+class of its size (rounded up), so whatever it finds is big enough.
+When a class grows past CACHE_COUNT blocks its oldest CACHE_BATCH blocks go back to their arenas (taking
+each lock once for a run of blocks from the same arena), and a thread gives back everything it still
+caches when it exits.
+Blocks that are malloced on one thread and freed on another (a producer handing work to a consumer) are
+the other problem: the freeing thread would have to take the owning arena's lock, right when its owner is
+busy mallocing the next one. So a thread that frees a block of an arena that isn't its own doesn't lock
+anything - it pushes the block onto the arena's remote stack with a single compare-and-swap (remote_push).
+The blocks stay allocated until the next mm_malloc in that arena takes the whole stack with one atomic
+exchange and frees them under the lock it holds anyway (remote_drain). An owner that stopped mallocing would
+never do that, so a push that makes the stack REMOTE_MAX blocks deep drains it itself if the lock is free, and
+so does every free that gets an arena's lock. That still leaves up to REMOTE_MAX blocks per arena behind an owner that
+stopped (or exited), so a thread that exits drains every arena's stack, and mm_stats and mm_check drain them before they
+count anything. With MM_ARENA_CPU an
+arena is nobody's own (see home_arena): free tries its lock first and only pushes if somebody holds it. Many threads push but only lock
+holders pop, and they take everything at once, so there is no ABA problem to worry about.
+mm_init starts a new heap generation, and a thread whose cache (or arena) is from an older generation just
+drops it the next time it looks - those blocks belonged to a heap that doesn't exist anymore.
+mm_init, mm_arenas and mm_check must not run while another thread is inside the allocator.
+All of this is about the heap of the calling thread (see struct mm_heap): generations are handed out across
+heaps, so a thread that moves to another heap with mm_heap_use drops nothing it shouldn't.
+*/
+
+#define CACHE_MAX 256 /* Blocks with up to this many payload bytes are cached */
+#define NUM_CACHE_CLASSES (CACHE_MAX / ALIGNMENT)
+#define CACHE_COUNT 8 /* A class caches at most this many blocks... */
+#define CACHE_BATCH (CACHE_COUNT / 2) /* ...and gives this many back to the heap when it overflows */
+#define REMOTE_MAX 256 /* A remote stack this deep isn't being drained by its owner, so the freeing threads do it */
+
+/* Given cached block ptr bp, compute the address of its link to the next cached block of its class */
+#define CACHE_NEXTP(bp) ((char **)(bp))
+
+/* Given any address p in the memory model, compute the arena whose region it is in */
+#define ARENA_OF(p) (heap->numArenas == 1 ? &heap->arenas[0] : &heap->arenas[((char *)(p) - heap->modelBase) / heap->arenaSpan])
+
+static unsigned int heapGen = 1; //the last generation mm_init handed out (to any heap) - a new thread (generation 0) never matches one
+static pthread_once_t arenaOnce = PTHREAD_ONCE_INIT;
+
+static __thread arena_t *myArena; //this thread's arena with MM_ARENA_RR...
+static __thread unsigned int myArenaGen; //...as of this heap generation
+static __thread char *cacheHead[NUM_CACHE_CLASSES + 1]; //class c lives at index c, index 0 is never used
+static __thread int cacheCount[NUM_CACHE_CLASSES + 1];
+static __thread unsigned int cacheGen; //the heap generation this thread's cache belongs to
+static __thread int cacheRegistered; //has this thread set up cacheKey, so it flushes its cache on exit?
+static pthread_key_t cacheKey;
+
+/* use_arena - make a the current arena, the one every heap_* function works on */
+static void use_arena(arena_t *a)
+{
+    arena = a;
+    firstBlock = a->firstBlock;
+    heapBase = a->heapBase;
+    binBase = a->binBase;
+}
+
+/* lock_arena - take the lock of arena a and make it the current arena */
+static void lock_arena(arena_t *a)
+{
+    pthread_mutex_lock(&a->lock);
+    use_arena(a);
+}
+
+static void unlock_arena(arena_t *a)
+{
+    pthread_mutex_unlock(&a->lock);
+}
+
+/* my_arena - the arena this thread mallocs from */
+static arena_t *my_arena(void)
+{
+    int cpu;
+
+    if (heap->numArenas == 1) {
+        return &heap->arenas[0];
+    }
+    if (heap->arenaPolicy == MM_ARENA_CPU) {
+        cpu = sched_getcpu();
+        return &heap->arenas[(cpu < 0 ? 0 : cpu) % heap->numArenas];
+    }
+    if (myArenaGen != heap->gen) {
+        myArena = &heap->arenas[__atomic_fetch_add(&heap->nextArena, 1, __ATOMIC_RELAXED) % heap->numArenas];
+        myArenaGen = heap->gen;
+    }
+    return myArena;
+}
+
+/*
+home_arena - the arena whose blocks this thread may cache or wait for when it frees them: its own with MM_ARENA_RR.
+With MM_ARENA_CPU there is none, since an arena belongs to whichever thread runs on its CPU right now, and a thread
+that migrated would otherwise take the blocks of its old arena for its own.
+*/
+static arena_t *home_arena(void)
+{
+    if (heap->numArenas > 1 && heap->arenaPolicy == MM_ARENA_CPU) {
+        return NULL;
+    }
+    return my_arena();
+}
+
+/* cache_sync - make sure this thread's cache belongs to the current heap, dropping it if it doesn't */
+static void cache_sync(void)
+{
+    if (cacheGen != heap->gen) {
+        memset(cacheHead, 0, sizeof(cacheHead));
+        memset(cacheCount, 0, sizeof(cacheCount));
+        cacheGen = heap->gen;
+    }
+}
+
+/*
+usable_size - the number of payload bytes of the allocated block (or run slot) bp. We don't hold the lock
+here, but nothing about an allocated block changes under us except the prev-alloc bit of its header (when
+the block before it is freed or allocated), so a single word-sized load of the header is all we need.
+*/
+static size_t usable_size(void *bp)
+{
+    if (IS_RUN(bp)) {
+        return GET(RUN_SLOTSIZEP(RUN_OF(bp)));
+    }
+    return (__atomic_load_n((size_t *)HDRP(bp), __ATOMIC_RELAXED) & ~(size_t)0x7) - WSIZE;
+}
+
+/*
+remote_push - push block bp, freed by a thread that doesn't own its arena a, onto a's remote stack. Returns whether
+the stack is REMOTE_MAX blocks deep now. The count sits next to the stack, whose cache line the push owns anyway, and
+it only has to be about right.
+*/
+static int remote_push(arena_t *a, char *bp)
+{
+    char *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+    do {
+        *CACHE_NEXTP(bp) = head;
+    } while (!__atomic_compare_exchange_n(&a->remote, &head, bp, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return __atomic_add_fetch(&a->remoteCount, 1, __ATOMIC_RELAXED) >= REMOTE_MAX;
+}
+
+/* remote_drain - free every block other threads pushed onto the current arena's remote stack. Needs the arena's lock */
+static void remote_drain(void)
+{
+    char *bp;
+    char *next;
+
+    if (__atomic_load_n(&arena->remote, __ATOMIC_RELAXED) == NULL) {//the usual case, and no need to own the cache line for it
+        return;
+    }
+    __atomic_store_n(&arena->remoteCount, 0, __ATOMIC_RELAXED);
+    for (bp = __atomic_exchange_n(&arena->remote, NULL, __ATOMIC_ACQUIRE); bp != NULL; bp = next) {
+        next = *CACHE_NEXTP(bp);
+        heap_free(bp);
+    }
+}
+
+/* cache_flush - keep the first (newest) keep blocks of class c and give the rest back to their arenas */
+static void cache_flush(int c, int keep)
+{
+    char **linkp = &cacheHead[c];
+    char *bp;
+    char *next;
+    arena_t *a;
+    arena_t *locked = NULL;
+    int i;
+
+    for (i = 0; i < keep; i++) {
+        linkp = CACHE_NEXTP(*linkp);
+    }
+    bp = *linkp;
+    *linkp = NULL;
+    cacheCount[c] = keep;
+
+    for (; bp != NULL; bp = next) {
+        next = *CACHE_NEXTP(bp);//heap_free is about to reuse the payload
+        a = ARENA_OF(bp);
+        if (a != locked) {//usually they all come from the same arena and this happens once
+            if (locked != NULL) {
+                unlock_arena(locked);
+            }
+            lock_arena(a);
+            locked = a;
+        }
+        heap_free(bp);
+    }
+    if (locked != NULL) {
+        unlock_arena(locked);
+    }
+}
+
+/*
+cache_exit - a thread is exiting, give everything it still caches back to the heap. Its arena's owner may have
+exited already too (or stopped mallocing), so whatever it pushed onto remote stacks goes back as well - along with
+everybody else's, since we are locking anyway.
+*/
+static void cache_exit(void *unused)
+{
+    arena_t *a;
+    int c;
+    int i;
+
+    if (cacheGen == heap->gen) {//otherwise nothing in there belongs to the current heap
+        for (c = 1; c <= NUM_CACHE_CLASSES; c++) {
+            if (cacheHead[c] != NULL) {
+                cache_flush(c, 0);
+            }
+        }
+    }
+    for (i = 0; i < heap->numArenas; i++) {
+        a = &heap->arenas[i];
+        if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) != NULL) {
+            lock_arena(a);
+            remote_drain();
+            unlock_arena(a);
+        }
+    }
+}
+
+/* cache_register - make sure cache_exit runs when this thread exits */
+static void cache_register(void)
+{
+    if (!cacheRegistered) {
+        pthread_setspecific(cacheKey, cacheHead);
+        cacheRegistered = 1;
+    }
+}
+
+/* arena_once - the things that only ever need setting up once: the default heap's arena locks and the key that flushes caches */
+static void arena_once(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_ARENAS; i++) {
+        pthread_mutex_init(&defaultHeap.arenas[i].lock, NULL);
+    }
+    pthread_key_create(&cacheKey, cache_exit);
+}
+
+/* mm_arenas - use n arenas, bound to threads by policy, from the next mm_init on. -1 if n is out of range */
+int mm_arenas(int n, int policy)
+{
+    if (n < 1 || n > MAX_ARENAS) {
+        return -1;
+    }
+    heap->numArenas = n;
+    heap->arenaPolicy = policy;
+    return 0;
+}
+
+/*
+mm_heap_create - a new heap with a memory model of its own, independent of every other heap. It has one arena
+until mm_arenas says otherwise, and like the default heap it has to be mm_init'ed (by a thread that has
+mm_heap_use'd it) before anything is allocated in it. NULL if there is no memory for it.
+*/
+mm_heap_t *mm_heap_create(void)
+{
+    mm_heap_t *h;
+    int i;
+
+    if ((h = calloc(1, sizeof(mm_heap_t))) == NULL) {
+        return NULL;
+    }
+    h->runPages = calloc(MAX_HEAP / RUN_SIZE + 1, 1);
+    h->mem = mem_create();
+    if (h->runPages == NULL || h->mem == NULL) {
+        free(h->runPages);
+        mem_destroy(h->mem);
+        free(h);
+        return NULL;
+    }
+    h->numArenas = 1;
+    h->arenaPolicy = MM_ARENA_RR;
+    for (i = 0; i < MAX_ARENAS; i++) {
+        pthread_mutex_init(&h->arenas[i].lock, NULL);
+    }
+    return h;
 }
 
+/* mm_heap_destroy - free a heap made by mm_heap_create, and everything in it. No thread may be using it anymore */
+void mm_heap_destroy(mm_heap_t *h)
+{
+    int i;
+
+    if (h == NULL) {
+        return;
+    }
+    for (i = 0; i < MAX_ARENAS; i++) {
+        pthread_mutex_destroy(&h->arenas[i].lock);
+    }
+    mem_destroy(h->mem);
+    free(h->runPages);
+    free(h);
+}
+
+/*
+mm_heap_use - make h (the default heap if NULL) the heap every mm_ call of this thread works on, and return
+the one it used before. A thread's cache can only hold blocks of one heap, so it goes back first.
+*/
+mm_heap_t *mm_heap_use(mm_heap_t *h)
+{
+    mm_heap_t *old = heap;
+
+    cache_exit(NULL);
+    heap = h ? h : &defaultHeap;
+    mem_use(heap->mem);
+    return old;
+}
 
+/*
+mm_fork_prepare, mm_fork_parent, mm_fork_child - pthread_atfork handlers for a program that forks while other threads
+malloc. fork copies the heap as it is, so a lock some other thread holds right then stays locked in the child, which
+doesn't have that thread, and its first malloc waits forever. So prepare takes every arena lock of the calling thread's
+heap (in order - nothing ever holds two at once, so that can't deadlock) and the parent lets go of them after the fork.
+In the child the forking thread is the only one left, and it just starts the locks over.
+*/
+void mm_fork_prepare(void)
+{
+    int i;
 
+    for (i = 0; i < heap->numArenas; i++) {
+        pthread_mutex_lock(&heap->arenas[i].lock);
+    }
+}
+
+void mm_fork_parent(void)
+{
+    int i;
+
+    for (i = 0; i < heap->numArenas; i++) {
+        pthread_mutex_unlock(&heap->arenas[i].lock);
+    }
+}
+
+void mm_fork_child(void)
+{
+    int i;
+
+    for (i = 0; i < heap->numArenas; i++) {
+        pthread_mutex_init(&heap->arenas[i].lock, NULL);
+    }
+}
+
+/*
+mm_init - split the memory model into a region per arena and heap_init every arena in its own region.
+It starts a new generation, so every thread drops its cache and arena of the old heap.
+*/
+int mm_init(void)
+{
+    int i;
+    int ret;
+
+    pthread_once(&arenaOnce, arena_once);
+    if (mem_regions(heap->numArenas) < 0) {
+        return -1;
+    }
+    heap->modelBase = mem_heap_lo();
+    heap->arenaSpan = heap->numArenas > 1 ? (size_t)((char *)mem_region_lo(1) - heap->modelBase) : 0;
+    for (i = 0; i < MAX_ARENAS; i++) {//forget about every run of the last heap
+        if (heap->arenas[i].runLo != NULL) {
+            memset(&IS_RUN(heap->arenas[i].runLo), 0, PAGE_INDEX(heap->arenas[i].runHi) - PAGE_INDEX(heap->arenas[i].runLo) + 1);
+            heap->arenas[i].runLo = heap->arenas[i].runHi = NULL;
+        }
+    }
+    heap->gen = __atomic_add_fetch(&heapGen, 1, __ATOMIC_RELAXED);
+    heap->nextArena = 0;
+    for (i = 0; i < heap->numArenas; i++) {
+        lock_arena(&heap->arenas[i]);
+        arena->region = i;
+        arena->remote = NULL;
+        arena->remoteCount = 0;
+        memset(&arena->stats, 0, sizeof(arena->stats));
+        memset(arena->binSizes, 0, sizeof(arena->binSizes));
+        arena->growSize = CHUNKSIZE;
+        arena->searches = arena->lastGrow = 0;
+        ret = heap_init();
+        arena->firstBlock = firstBlock;
+        arena->heapBase = heapBase;
+        arena->binBase = binBase;
+        unlock_arena(&heap->arenas[i]);
+        if (ret < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* mm_malloc - pop a block off this thread's cache if it has one that fits, heap_malloc in this thread's arena otherwise */
+void *mm_malloc(size_t size)
+{
+    size_t c = (size + ALIGNMENT - 1) / ALIGNMENT;
+    arena_t *a;
+    char *bp;
+    int i;
+
+    if (size == 0) {
+        return NULL;
+    }
+    if (c <= NUM_CACHE_CLASSES) {
+        cache_sync();
+        if ((bp = cacheHead[c]) != NULL) {
+            cacheHead[c] = *CACHE_NEXTP(bp);
+            cacheCount[c]--;
+            return bp;
+        }
+    }
+    a = my_arena();
+    lock_arena(a);
+    remote_drain();
+    bp = heap_malloc(size);
+    unlock_arena(a);
+    for (i = 1; bp == NULL && i < heap->numArenas; i++) {//our arena is full - maybe another one isn't
+        a = &heap->arenas[(a - heap->arenas + 1) % heap->numArenas];
+        lock_arena(a);
+        remote_drain();
+        bp = heap_malloc(size);
+        unlock_arena(a);
+    }
+    return bp;
+}
+
+/*
+mm_memalign - a block of size bytes whose payload address is a multiple of align (a power of 2), from this
+thread's arena or, if that is full, any other. It never comes from the cache, which doesn't know about
+alignment. NULL if align isn't a power of 2.
+*/
+void *mm_memalign(size_t align, size_t size)
+{
+    arena_t *a;
+    char *bp;
+    int i;
+
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+    if (align <= ALIGNMENT) {
+        return mm_malloc(size);
+    }
+    a = my_arena();
+    lock_arena(a);
+    remote_drain();
+    bp = heap_memalign(align, size);
+    unlock_arena(a);
+    for (i = 1; bp == NULL && i < heap->numArenas; i++) {
+        a = &heap->arenas[(a - heap->arenas + 1) % heap->numArenas];
+        lock_arena(a);
+        remote_drain();
+        bp = heap_memalign(align, size);
+        unlock_arena(a);
+    }
+    return bp;
+}
 
+/* mm_aligned_alloc - the C11 name for mm_memalign */
+void *mm_aligned_alloc(size_t align, size_t size)
+{
+    return mm_memalign(align, size);
+}
 
+/*
+mm_calloc - a zeroed block for nmemb elements of size bytes each, NULL if that many bytes don't fit in a size_t.
+Small blocks may come from the cache, so they are always memset. Bigger ones go to heap_calloc, which tells us
+when the block is already zero, and the memset (when we need one) happens after the lock is dropped.
+*/
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    arena_t *a;
+    char *bp;
+    int zeroed = 0;
+    int i;
 
+    if (__builtin_mul_overflow(nmemb, size, &bytes) || bytes == 0) {
+        return NULL;
+    }
+    if (bytes <= CACHE_MAX) {
+        if ((bp = mm_malloc(bytes)) != NULL) {
+            memset(bp, 0, bytes);
+        }
+        return bp;
+    }
+    a = my_arena();
+    lock_arena(a);
+    remote_drain();
+    bp = heap_calloc(bytes, &zeroed);
+    unlock_arena(a);
+    for (i = 1; bp == NULL && i < heap->numArenas; i++) {
+        a = &heap->arenas[(a - heap->arenas + 1) % heap->numArenas];
+        lock_arena(a);
+        remote_drain();
+        bp = heap_calloc(bytes, &zeroed);
+        unlock_arena(a);
+    }
+    if (bp != NULL && !zeroed) {
+        memset(bp, 0, bytes);
+    }
+    return bp;
+}
 
+/*
+mm_free - a block of another thread's arena goes onto that arena's remote stack, and if the stack has grown past
+REMOTE_MAX (its owner may have stopped mallocing, and won't drain it) we drain it ourselves when the lock happens
+to be free. Any
+other block is heap_free'd right away if nobody holds the lock of its arena, emptying the remote stack while we are
+at it. If somebody does, a small block of our own goes onto this thread's cache (flushing a batch if the class
+overflows) instead of waiting.
+*/
+void mm_free(void *ptr)
+{
+    arena_t *a;
+    arena_t *home;
+    size_t c;
 
+    if (ptr == NULL) {
+        return;
+    }
+    a = ARENA_OF(ptr);//the block knows its arena, wherever we happen to be running
+    home = home_arena();
+    if (home != NULL && a != home) {
+        cache_register();//the owner may never drain this one, so we do on the way out
+        if (remote_push(a, ptr) && pthread_mutex_trylock(&a->lock) == 0) {
+            use_arena(a);
+            remote_drain();
+            unlock_arena(a);
+        }
+        return;
+    }
+    if (pthread_mutex_trylock(&a->lock) == 0) {
+        use_arena(a);
+        heap_free(ptr);
+        remote_drain();
+        unlock_arena(a);
+        return;
+    }
+    if (a != home) {//MM_ARENA_CPU, and somebody is using the arena
+        cache_register();
+        remote_push(a, ptr);
+        return;
+    }
+    c = usable_size(ptr) / ALIGNMENT;
+    if (c <= NUM_CACHE_CLASSES) {
+        cache_sync();
+        cache_register();
+        *CACHE_NEXTP(ptr) = cacheHead[c];
+        cacheHead[c] = ptr;
+        if (++cacheCount[c] > CACHE_COUNT) {
+            cache_flush(c, CACHE_COUNT - CACHE_BATCH);
+        }
+        return;
+    }
+    lock_arena(a);
+    heap_free(ptr);
+    unlock_arena(a);
+}
 
+/*
+mm_realloc - heap_realloc in the block's own arena. If that arena is out of memory the block moves
+to whichever arena mm_malloc finds room in. A cached block never gets here - it isn't the caller's anymore.
+*/
+void *mm_realloc(void *ptr, size_t size)
+{
+    arena_t *a;
+    void *newptr;
+    size_t copySize;
 
+    if (ptr == NULL) {
+        return mm_malloc(size);
+    }
+    a = ARENA_OF(ptr);
+    lock_arena(a);
+    remote_drain();
+    newptr = heap_realloc(ptr, size);
+    unlock_arena(a);
+    if (newptr == NULL && size > 0 && size <= MAX_HEAP && heap->numArenas > 1 && (newptr = mm_malloc(size)) != NULL) {
+        copySize = usable_size(ptr);
+        memcpy(newptr, ptr, copySize < size ? copySize : size);
+        mm_free(ptr);
+    }
+    return newptr;
+}
 
+/* mm_usable_size - how many bytes the caller may use of the block ptr (at least what it asked for) */
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL) {
+        return 0;
+    }
+    return usable_size(ptr);
+}
 
+/*
+mm_stats - add up the counters of every arena into *stats. The counters are kept as blocks come and go so reading them
+is O(1) per arena; only largest_free has to look at the heap, and that's a walk down the treap's right spine (or a
+look at the arena's count of bin blocks of each size, when the treap is empty). Every field of
+mm_stats_t is a size_t, so the arenas are summed word by word. Blocks on an arena's remote stack aren't anybody's
+anymore, so they are freed first rather than counted as live.
+*/
+void mm_stats(mm_stats_t *stats)
+{
+    arena_t *saved = arena;
+    size_t *sum = (size_t *)stats;
+    size_t *add, largest;
+    size_t j;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < heap->numArenas; i++) {
+        lock_arena(&heap->arenas[i]);
+        remote_drain();
+        add = (size_t *)&arena->stats;
+        for (j = 0; j < sizeof(mm_stats_t) / sizeof(size_t); j++) {
+            sum[j] += add[j];
+        }
+        stats->heap_bytes += (char *)mem_region_hi(arena->region) + 1 - (char *)mem_region_lo(arena->region);
+        largest = largest_free();
+        if (largest > stats->largest_free) {
+            stats->largest_free = largest;
+        }
+        unlock_arena(&heap->arenas[i]);
+    }
+    if (saved != NULL) {
+        use_arena(saved);
+    }
+}
 
+/*
+mm_check - heap_check every arena. The blocks on its remote stack are still allocated as far as the heap is concerned,
+so they get freed first - after making sure each of them is in the arena, since freeing a stray pointer would wreck
+the heap we are about to check. Nobody else is in the allocator, so the lock isn't needed.
+*/
+int mm_check(void)
+{
+    arena_t *saved = arena;
+    char *bp;
+    size_t n;
+    int ok = 1;
+    int i;
+
+    for (i = 0; i < heap->numArenas && ok; i++) {
+        use_arena(&heap->arenas[i]);
+        for (bp = arena->remote, n = 0; bp != NULL; bp = *CACHE_NEXTP(bp), n++) {
+            if (bp < (char *)mem_region_lo(arena->region) || bp > (char *)mem_region_hi(arena->region) || n > arena->stats.live_bytes / ALIGNMENT) {
+                printf("remote stack of arena %d points at %p, which is outside the arena or past its %lu live bytes\n", i, bp, (unsigned long)arena->stats.live_bytes);
+                return 0;
+            }
+        }
+        remote_drain();
+        ok = heap_check();
+    }
+    if (saved != NULL) {
+        use_arena(saved);
+    }
+    return ok;
+}
@@ -4,6 +4,52 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern void *mm_aligned_alloc(size_t align, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern size_t mm_usable_size(void *ptr);
+
+/* How threads are bound to arenas (see mm_arenas) */
+#define MM_ARENA_RR  0 /* round robin, in the order threads first malloc */
+#define MM_ARENA_CPU 1 /* the arena of the CPU the thread is running on */
+
+extern int mm_arenas(int n, int policy);
+
+/* What mm_stats reports about the heap, all of its arenas together */
+#define MM_FREE_CLASSES 7 /* free blocks are counted per bin, and the last class is the treap */
+
+typedef struct {
+    size_t live_bytes;      /* payload bytes of allocated blocks (cached ones too) */
+    size_t free_bytes;      /* bytes in free blocks */
+    size_t heap_bytes;      /* bytes of heap */
+    size_t free_blocks[MM_FREE_CLASSES]; /* free blocks in each size class */
+    size_t fast_bytes;      /* bytes in fast bins: freed, but not coalesced yet... */
+    size_t fast_blocks;     /* ...in this many blocks */
+    size_t largest_free;    /* size of the largest free block */
+    size_t extends;         /* times the heap was extended... */
+    size_t extend_bytes;    /* ...by this many bytes in all */
+    size_t coalesces[4];    /* coalesce calls that were case 1, 2, 3 and 4 */
+    size_t splits;          /* free blocks split to place a block */
+    size_t consolidations;  /* times the fast bins were emptied into the heap */
+    size_t realloc_grows;   /* reallocs that grew the block in place... */
+    size_t realloc_shrinks; /* ...shrank it (or kept its size) in place... */
+    size_t realloc_moves;   /* ...or had to move it */
+    size_t calloc_zeroed;   /* callocs whose block was known to be zero already, so it wasn't memset */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/* Independent heaps, each with a memory model of its own (see mm_heap_create) */
+typedef struct mm_heap mm_heap_t;
+
+extern mm_heap_t *mm_heap_create(void);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern mm_heap_t *mm_heap_use(mm_heap_t *h);
+
+/* pthread_atfork handlers, so a child can malloc whatever the other threads were doing (see mm_fork_prepare) */
+extern void mm_fork_prepare(void);
+extern void mm_fork_parent(void);
+extern void mm_fork_child(void);
 
 
 /* 
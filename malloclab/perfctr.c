@@ -0,0 +1,135 @@
+/*
+ * perfctr.c - Hardware performance counters (Linux perf_event_open)
+ *
+ * Every event gets a counter of its own, counting this process in
+ * user mode only (which even a paranoid kernel lets us do). When there
+ * are more events than hardware counters the kernel takes turns with
+ * them, and we scale each count up by the fraction of the time it was
+ * actually counting. Containers and VMs often hide the hardware events
+ * altogether; then we just count what we can, which may be nothing.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#define CACHE_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+			   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* The type and config perf_event_open wants for each event */
+static struct {
+    unsigned type;
+    unsigned long long config;
+    char *name;
+} events[PERF_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instrs"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D), "L1d-miss"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL), "LLC-miss"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB), "dTLB-miss"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "br-miss"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "faults"},
+};
+#else
+static struct {
+    char *name;
+} events[PERF_NUM] = {
+    {"cycles"}, {"instrs"}, {"L1d-miss"}, {"LLC-miss"},
+    {"dTLB-miss"}, {"br-miss"}, {"faults"},
+};
+#endif
+
+static int fds[PERF_NUM];  /* counter of each event, -1 if we have none */
+
+/*
+ * perf_init - Open a counter for every event we are allowed to count.
+ *    Returns how many we got.
+ */
+int perf_init(int verbose)
+{
+    int i, n = 0;
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    for (i = 0; i < PERF_NUM; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+	else if (verbose)
+	    printf("Can't count %s: %s\n", events[i].name, strerror(errno));
+    }
+#else
+    for (i = 0; i < PERF_NUM; i++)
+	fds[i] = -1;
+    if (verbose)
+	printf("Can't count hardware events on this system\n");
+#endif
+    return n;
+}
+
+/*
+ * perf_start - Zero the counters and start counting
+ */
+void perf_start(void)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < PERF_NUM; i++)
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+/*
+ * perf_stop - Stop counting and store each count (scaled up if the
+ *    counter had to share the hardware) in counts[], -1 if we have
+ *    no counter for it
+ */
+void perf_stop(double *counts)
+{
+    int i;
+#ifdef __linux__
+    unsigned long long val[3]; /* count, time enabled, time running */
+
+    for (i = 0; i < PERF_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    for (i = 0; i < PERF_NUM; i++) {
+	counts[i] = -1;
+#ifdef __linux__
+	if (fds[i] < 0 || read(fds[i], val, sizeof(val)) != sizeof(val))
+	    continue;
+	if (val[2] == 0)      /* never got a hardware counter */
+	    counts[i] = 0;
+	else
+	    counts[i] = (double)val[0] * val[1] / val[2];
+#endif
+    }
+}
+
+/*
+ * perf_name - Short name of event i
+ */
+char *perf_name(int i)
+{
+    return events[i].name;
+}
@@ -0,0 +1,27 @@
+/*
+ * perfctr.h - Hardware performance counters (Linux perf_event_open)
+ */
+
+/* The events we count, in the order perf_stop reports them */
+#define PERF_CYCLES       0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES   2
+#define PERF_LLC_MISSES   3
+#define PERF_DTLB_MISSES  4
+#define PERF_BRANCH_MISSES 5
+#define PERF_PAGE_FAULTS  6
+#define PERF_NUM          7
+
+/* Open a counter for every event this machine (or container) lets us
+   count. Returns how many we got, 0 if none */
+int perf_init(int verbose);
+
+/* Zero the counters and start counting */
+void perf_start(void);
+
+/* Stop counting and store each count in counts[], or -1 for events
+   we couldn't open */
+void perf_stop(double *counts);
+
+/* Short name of event i, for table headings */
+char *perf_name(int i);
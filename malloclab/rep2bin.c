@@ -0,0 +1,38 @@
+/*
+ * rep2bin.c - Convert a .rep trace file to the binary trace format
+ *
+ * The binary trace (see trace.h) holds the same requests, but mdriver
+ * maps it instead of parsing it, which matters for traces of millions
+ * of requests. Since read_trace takes either format, this also checks
+ * (and copies) a binary trace. The trace is streamed through, so it
+ * can be far bigger than memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read_trace wants to know */
+
+int main(int argc, char **argv)
+{
+    trace_t *trace;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: %s <in.rep> <out>\n", argv[0]);
+	exit(1);
+    }
+
+    trace = read_trace("", argv[1], 1);
+    if (write_trace_bin(trace, argv[2]) < 0) {
+	printf("%s: %s\n", argv[2], strerror(errno));
+	exit(1);
+    }
+    printf("%s: %d ids, %lld requests, %d thread%s\n", argv[2],
+	   trace->num_ids, (long long)trace->num_ops, trace->num_threads,
+	   trace->num_threads == 1 ? "" : "s");
+    free_trace(trace);
+    exit(0);
+}
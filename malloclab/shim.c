@@ -0,0 +1,681 @@
+/*
+ * shim.c - Run real programs on mm.c: an LD_PRELOAD library whose
+ *          malloc, free, calloc, realloc and friends are mm_malloc,
+ *          mm_free and mm_realloc
+ *
+ *     unix> LD_PRELOAD=./libmm.so ls -l
+ *
+ * The heap is memlib's, which is mmap'ed anyway, so nothing changes
+ * but the size it is allowed to grow to (MAX_HEAP). The library is
+ * built with ALIGNMENT 16, since that is what programs expect of malloc
+ * on a 64-bit system. Environment variables:
+ *
+ *     MM_ARENAS=n    Use n arenas (see mm_arenas) instead of 1
+ *     MM_TRACE=path  Record every request into a .rep trace at path
+ *                    ("%p" in path becomes the process id, which keeps
+ *                    the programs a program runs from sharing one trace)
+ *
+ * A program may fork while its other threads malloc: fork holds every
+ * arena lock (see mm_fork_prepare), so the child's heap is never in
+ * the middle of a request.
+ *
+ * Recording
+ * ---------
+ * Every request takes a number from one global counter, and the
+ * thread that made it keeps it in a buffer of its own until the buffer
+ * is full, then appends the whole buffer to a raw file with one
+ * write(2). So the requests reach the file out of order, but their
+ * numbers have no gaps: at exit we put request i in slot i of an array
+ * and replay that array once to turn addresses into ids, recycling ids
+ * as the blocks they stand for are freed.
+ *
+ * For that to give a valid trace, the number has to order a block's
+ * requests with those of whoever gets its address next. A free takes
+ * its number before the block is freed and a malloc after it has its
+ * block, so they are. A realloc that moves a block frees the old one
+ * in the middle, though, so while recording realloc grows by mallocing
+ * a new block, taking its number, and only then copying and freeing
+ * the old block (and never moves a block that is shrinking at all).
+ *
+ * The trace is written at exit(), so a program that leaves through
+ * _exit() or a signal leaves only the raw file behind, and requests
+ * other threads make while the process is exiting may be missed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "trace.h"
+#include "config.h"
+
+#define SHIM_EXPORT __attribute__((visibility("default")))
+
+#define REC_COUNT 4096   /* requests a thread buffers before writing them */
+#define HDRWIDTH 20      /* header numbers are padded to this width */
+#define MAXPATH 4096
+
+/* What a record says happened */
+enum {REC_NONE, REC_MALLOC, REC_FREE, REC_REALLOC, REC_MEMALIGN, REC_CALLOC};
+
+/* One request, as it goes into the raw file */
+typedef struct {
+    uint64_t seq;        /* number of the request */
+    char *old;           /* block freed or realloc'ed */
+    char *new;           /* block malloc'ed or realloc'ed */
+    uint32_t size;       /* and its size */
+    uint16_t tid;        /* thread that made the request */
+    uint8_t type;        /* REC_xxx (REC_NONE: there was no such request) */
+    uint8_t align;       /* log2 of the alignment a REC_MEMALIGN asked for */
+} rec_t;
+
+/* A thread's records, waiting to be written */
+typedef struct recbuf {
+    struct recbuf *next; /* every buffer there is, for the flush at exit */
+    int used;            /* does a thread own it? */
+    int count;           /* records in rec[] */
+    rec_t rec[REC_COUNT];
+} recbuf_t;
+
+static volatile int initState;  /* 0, 1 while shim_init runs, 2 after */
+static char *heapLo, *heapHi;   /* the memory model - no other pointer is ours */
+
+static int recording;           /* are we writing a trace? */
+static uint64_t recSeq;         /* number of the next request */
+static int recFd = -1;          /* the raw file */
+static char tracePath[MAXPATH]; /* the trace, the raw file is this plus ".raw" */
+static char rawPath[MAXPATH];
+static recbuf_t *recBufs;       /* every buffer, owned or not */
+static unsigned int nextTid;
+static pthread_key_t recKey;    /* gives a thread's buffer back when it exits */
+
+static __thread recbuf_t *myBuf;
+static __thread unsigned int myTid;
+
+/*
+ * shim_error - Nothing here can call printf (it mallocs), so write()
+ *    the message ourselves
+ */
+static void shim_error(char *msg)
+{
+    write(2, "libmm: ", 7);
+    write(2, msg, strlen(msg));
+    write(2, "\n", 1);
+}
+
+/*
+ * rec_flush - Append the records in b to the raw file
+ */
+static void rec_flush(recbuf_t *b)
+{
+    size_t len = b->count * sizeof(rec_t);
+
+    if (len > 0 && write(recFd, b->rec, len) != (ssize_t)len)
+	shim_error("can't write the raw trace, the trace will have holes");
+    b->count = 0;
+}
+
+/*
+ * rec_exit - A thread is exiting: write its records and let another
+ *    thread have its buffer
+ */
+static void rec_exit(void *ptr)
+{
+    recbuf_t *b = (recbuf_t *)ptr;
+
+    rec_flush(b);
+    __atomic_store_n(&b->used, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * rec_buffer - This thread's buffer: one an exited thread left, or a
+ *    new one. NULL if there is no memory for one.
+ */
+static recbuf_t *rec_buffer(void)
+{
+    recbuf_t *b;
+    int unused;
+
+    for (b = __atomic_load_n(&recBufs, __ATOMIC_ACQUIRE); b; b = b->next) {
+	unused = 0;
+	if (__atomic_compare_exchange_n(&b->used, &unused, 1, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	    break;
+    }
+    if (b == NULL) {
+	b = mmap(NULL, sizeof(recbuf_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+	    return NULL;
+	b->used = 1;
+	b->next = __atomic_load_n(&recBufs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&recBufs, &b->next, b, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	    ;
+    }
+    myBuf = b;  /* pthread_setspecific may malloc, and so record */
+    myTid = __atomic_fetch_add(&nextTid, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(recKey, b);
+    return b;
+}
+
+/*
+ * record - Number a request and buffer it
+ */
+static void record(int type, void *old, void *new, size_t size, int align)
+{
+    rec_t *r;
+
+    if (!__atomic_load_n(&recording, __ATOMIC_RELAXED))
+	return;
+    if (myBuf == NULL && (myBuf = rec_buffer()) == NULL)
+	return;
+    r = &myBuf->rec[myBuf->count];
+    r->seq = __atomic_fetch_add(&recSeq, 1, __ATOMIC_RELAXED);
+    r->type = size > INT32_MAX ? REC_NONE : type; /* too big for a trace */
+    r->tid = myTid % TRACE_MAX_THREADS;
+    r->old = (char *)old;
+    r->new = (char *)new;
+    r->size = size;
+    r->align = align;
+    if (++myBuf->count == REC_COUNT)
+	rec_flush(myBuf);
+}
+
+/*
+ * rec_child - A forked child has its own heap (a copy of ours), but
+ *    not its own trace
+ */
+static void rec_child(void)
+{
+    recording = 0;
+    if (recFd >= 0)
+	close(recFd);
+    recFd = -1;
+}
+
+/*
+ * rec_start - Start recording into the trace MM_TRACE names
+ */
+static void rec_start(char *path)
+{
+    char pid[16], *p;
+    size_t n = 0, len;
+    int i;
+
+    /* Copy path, putting in our pid for a %p */
+    for (; *path && n < MAXPATH - 16; path++) {
+	if (path[0] == '%' && path[1] == 'p') {
+	    p = pid + sizeof(pid);
+	    *--p = '\0';
+	    for (i = getpid(); i > 0 || *p == '\0'; i /= 10)
+		*--p = '0' + i % 10;
+	    len = strlen(p);
+	    memcpy(tracePath + n, p, len);
+	    n += len;
+	    path++;
+	} else
+	    tracePath[n++] = *path;
+    }
+    tracePath[n] = '\0';
+    memcpy(rawPath, tracePath, n);
+    memcpy(rawPath + n, ".raw", 5);
+
+    if ((recFd = open(rawPath, O_RDWR | O_CREAT | O_TRUNC | O_APPEND,
+		      0644)) < 0) {
+	shim_error("can't create the raw trace, not recording");
+	return;
+    }
+    pthread_key_create(&recKey, rec_exit);
+    recording = 1;
+}
+
+/*
+ * shim_init - Set up the heap (and the recording) on the first call
+ *    into the library. Whoever gets here first does it, everyone else
+ *    waits.
+ */
+static void shim_init(void)
+{
+    int state = 0;
+    char *s;
+
+    if (!__atomic_compare_exchange_n(&initState, &state, 1, 0,
+				     __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+	while (__atomic_load_n(&initState, __ATOMIC_ACQUIRE) != 2)
+	    ;
+	return;
+    }
+    mem_init();
+    if ((s = getenv("MM_ARENAS")) != NULL &&
+	mm_arenas(atoi(s), MM_ARENA_RR) < 0)
+	shim_error("bad MM_ARENAS, using 1 arena");
+    if (mm_init() < 0) {
+	shim_error("mm_init failed");
+	abort();
+    }
+    heapLo = (char *)mem_heap_lo();
+    heapHi = heapLo + MAX_HEAP;
+    if ((s = getenv("MM_TRACE")) != NULL && *s)
+	rec_start(s);
+    __atomic_store_n(&initState, 2, __ATOMIC_RELEASE);
+
+    /* A thread that forks while others malloc would leave the child
+       arena locks nobody lets go of. pthread_atfork may malloc, which
+       only works once we're done here */
+    pthread_atfork(mm_fork_prepare, mm_fork_parent, mm_fork_child);
+    if (recording)
+	pthread_atfork(NULL, NULL, rec_child);
+}
+
+#define INIT() do { if (initState != 2) shim_init(); } while (0)
+
+/* Is p one of our blocks? Anything else must not reach mm_free */
+#define OURS(p) ((char *)(p) >= heapLo && (char *)(p) < heapHi)
+
+/*
+ * The allocation functions
+ */
+
+SHIM_EXPORT void *malloc(size_t size)
+{
+    void *p;
+
+    INIT();
+    if ((p = mm_malloc(size ? size : 1)) == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    record(REC_MALLOC, NULL, p, size ? size : 1, 0);
+    return p;
+}
+
+SHIM_EXPORT void free(void *ptr)
+{
+    if (ptr == NULL || !OURS(ptr))
+	return;
+    record(REC_FREE, ptr, NULL, 0, 0);
+    mm_free(ptr);
+}
+
+SHIM_EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+    void *p;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* mm_calloc skips the memset when the block is known to be zero */
+    INIT();
+    if ((p = mm_calloc(1, bytes ? bytes : 1)) == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    record(REC_CALLOC, NULL, p, bytes ? bytes : 1, 0);
+    return p;
+}
+
+SHIM_EXPORT void *realloc(void *ptr, size_t size)
+{
+    size_t oldsize;
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (!OURS(ptr)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (!recording) {
+	if ((p = mm_realloc(ptr, size)) == NULL)
+	    errno = ENOMEM;
+	return p;
+    }
+
+    /* Recording: never let the old block go before the new one is ours */
+    oldsize = mm_usable_size(ptr);
+    if (size <= oldsize) {
+	record(REC_REALLOC, ptr, ptr, size, 0);
+	return ptr;
+    }
+    if ((p = mm_malloc(size)) == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    record(REC_REALLOC, ptr, p, size, 0);
+    memcpy(p, ptr, oldsize);
+    mm_free(ptr);
+    return p;
+}
+
+/*
+ * shim_memalign - What all the aligned allocation functions come down
+ *    to. align must be a power of 2.
+ */
+static void *shim_memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (align <= ALIGNMENT)
+	return malloc(size);
+    INIT();
+    if ((p = mm_memalign(align, size ? size : 1)) == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    record(align > (size_t)1 << TRACE_MAX_ALIGN ? REC_NONE : REC_MEMALIGN,
+	   NULL, p, size ? size : 1, __builtin_ctzl(align));
+    return p;
+}
+
+SHIM_EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+	return EINVAL;
+    if ((p = shim_memalign(align, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+SHIM_EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return shim_memalign(align, size);
+}
+
+SHIM_EXPORT void *memalign(size_t align, size_t size)
+{
+    return aligned_alloc(align, size);
+}
+
+SHIM_EXPORT void *valloc(size_t size)
+{
+    return shim_memalign(mem_pagesize(), size);
+}
+
+SHIM_EXPORT void *pvalloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    return shim_memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+SHIM_EXPORT size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL || !OURS(ptr))
+	return 0;
+    return mm_usable_size(ptr);
+}
+
+/*
+ * Writing the trace
+ */
+
+/* Addresses of the live blocks and their ids, and the ids we can reuse */
+typedef struct {
+    char **addr;         /* hash table of addresses (NULL: empty slot)... */
+    int *id;             /* ...and the id of each */
+    size_t mask;         /* the table has mask+1 slots */
+    size_t count;        /* of which this many are in use */
+    int *free_ids;       /* stack of ids whose block was freed */
+    int num_free;
+    int num_ids;         /* ids handed out so far */
+    size_t *sizes;       /* size of the block of each id */
+    size_t live, peak;   /* bytes in live blocks, now and at most */
+} idmap_t;
+
+static size_t addr_hash(idmap_t *m, char *p)
+{
+    uint64_t h = (uintptr_t)p;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h & m->mask;
+}
+
+/*
+ * id_lookup - Slot of address p in the table, or the empty slot where
+ *    it would go
+ */
+static size_t id_lookup(idmap_t *m, char *p)
+{
+    size_t i;
+
+    for (i = addr_hash(m, p); m->addr[i] && m->addr[i] != p;
+	 i = (i + 1) & m->mask)
+	;
+    return i;
+}
+
+/*
+ * id_table - Make a table of n slots (a power of 2) and put every
+ *    address of the old one into it
+ */
+static int id_table(idmap_t *m, size_t n)
+{
+    char **addr = m->addr;
+    int *id = m->id;
+    size_t i, j, old = addr ? m->mask + 1 : 0;
+
+    m->addr = calloc(n, sizeof(char *));
+    m->id = malloc(n * sizeof(int));
+    if (m->addr == NULL || m->id == NULL)
+	return -1;
+    m->mask = n - 1;
+    for (i = 0; i < old; i++)
+	if (addr[i]) {
+	    j = id_lookup(m, addr[i]);
+	    m->addr[j] = addr[i];
+	    m->id[j] = id[i];
+	}
+    free(addr);
+    free(id);
+    return 0;
+}
+
+/*
+ * id_new - An id for a new block, a recycled one if we can
+ */
+static int id_new(idmap_t *m)
+{
+    int id;
+
+    if (m->num_free > 0)
+	return m->free_ids[--m->num_free];
+    id = m->num_ids++;
+    if ((id & (id - 1)) == 0 && id >= 1024) { /* the arrays are full */
+	m->sizes = realloc(m->sizes, 2 * id * sizeof(size_t));
+	m->free_ids = realloc(m->free_ids, 2 * id * sizeof(int));
+	if (m->sizes == NULL || m->free_ids == NULL)
+	    return -1;
+    }
+    return id;
+}
+
+/*
+ * id_add - Remember that block p of size bytes has id
+ */
+static int id_add(idmap_t *m, char *p, int id, size_t size)
+{
+    size_t i;
+
+    if (2 * (m->count + 1) > m->mask + 1 && id_table(m, 2 * (m->mask + 1)) < 0)
+	return -1;
+    i = id_lookup(m, p);
+    m->addr[i] = p;
+    m->id[i] = id;
+    m->count++;
+    m->sizes[id] = size;
+    m->live += size;
+    if (m->live > m->peak)
+	m->peak = m->live;
+    return 0;
+}
+
+/*
+ * id_drop - Forget block p, and return the id it had (-1 if it had
+ *    none, which happens when the request that made it went missing)
+ *    so the caller can reuse it
+ */
+static int id_drop(idmap_t *m, char *p)
+{
+    size_t i = id_lookup(m, p), j, k;
+    int id = m->id[i];
+
+    if (m->addr[i] == NULL)
+	return -1;
+
+    /* Shift later entries back so no lookup runs into a hole */
+    m->addr[i] = NULL;
+    for (j = (i + 1) & m->mask; m->addr[j]; j = (j + 1) & m->mask) {
+	k = addr_hash(m, m->addr[j]);
+	if (((j - k) & m->mask) >= ((j - i) & m->mask)) {
+	    m->addr[i] = m->addr[j];
+	    m->id[i] = m->id[j];
+	    m->addr[j] = NULL;
+	    i = j;
+	}
+    }
+    m->count--;
+    m->live -= m->sizes[id];
+    return id;
+}
+
+/*
+ * write_trace - Put the n records in recs in order and write them
+ *    out as a .rep trace
+ */
+static int write_trace(rec_t *raw, size_t n, uint64_t num_seqs)
+{
+    rec_t *recs, *r;
+    idmap_t m;
+    FILE *f;
+    long long ops = 0;
+    int id, tid = 0;
+    size_t i;
+
+    recs = mmap(NULL, num_seqs * sizeof(rec_t) + 1, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (recs == MAP_FAILED)
+	return -1;
+    for (i = 0; i < n; i++)       /* unfilled slots stay REC_NONE */
+	if (raw[i].seq < num_seqs)
+	    recs[raw[i].seq] = raw[i];
+
+    memset(&m, 0, sizeof(m));
+    m.sizes = malloc(1024 * sizeof(size_t));
+    m.free_ids = malloc(1024 * sizeof(int));
+    if (m.sizes == NULL || m.free_ids == NULL || id_table(&m, 1024) < 0 ||
+	(f = fopen(tracePath, "w")) == NULL) {
+	munmap(recs, num_seqs * sizeof(rec_t) + 1);
+	return -1;
+    }
+    fprintf(f, "%*s\n%*s\n%*s\n%*s\n", HDRWIDTH, "", HDRWIDTH, "",
+	    HDRWIDTH, "", HDRWIDTH, "");
+
+    for (r = recs; r < recs + num_seqs; r++) {
+	if (r->type == REC_NONE)
+	    continue;
+	if (r->tid != tid) {
+	    tid = r->tid;
+	    fprintf(f, "t %d\n", tid);
+	}
+	switch (r->type) {
+	case REC_MALLOC:
+	    if ((id = id_new(&m)) < 0 || id_add(&m, r->new, id, r->size) < 0)
+		goto nomem;
+	    fprintf(f, "a %d %u\n", id, r->size);
+	    break;
+	case REC_MEMALIGN:
+	    if ((id = id_new(&m)) < 0 || id_add(&m, r->new, id, r->size) < 0)
+		goto nomem;
+	    fprintf(f, "m %d %u %lu\n", id, r->size, 1UL << r->align);
+	    break;
+	case REC_CALLOC:
+	    if ((id = id_new(&m)) < 0 || id_add(&m, r->new, id, r->size) < 0)
+		goto nomem;
+	    fprintf(f, "c %d %u\n", id, r->size);
+	    break;
+	case REC_FREE:
+	    if ((id = id_drop(&m, r->old)) < 0)
+		continue;
+	    m.free_ids[m.num_free++] = id;
+	    fprintf(f, "f %d\n", id);
+	    break;
+	case REC_REALLOC:                 /* the block keeps its id */
+	    if ((id = id_drop(&m, r->old)) < 0)
+		continue;
+	    if (id_add(&m, r->new, id, r->size) < 0)
+		goto nomem;
+	    fprintf(f, "r %d %u\n", id, r->size);
+	    break;
+	}
+	ops++;
+    }
+
+    rewind(f);
+    fprintf(f, "%*lld\n%*d\n%*lld\n%*d\n", HDRWIDTH,
+	    (long long)(m.peak > INT32_MAX ? INT32_MAX : m.peak),
+	    HDRWIDTH, m.num_ids > 0 ? m.num_ids : 1, HDRWIDTH, ops, HDRWIDTH, 1);
+    munmap(recs, num_seqs * sizeof(rec_t) + 1);
+    return fclose(f);
+
+ nomem:
+    fclose(f);
+    munmap(recs, num_seqs * sizeof(rec_t) + 1);
+    return -1;
+}
+
+/*
+ * rec_finish - At exit, write every buffer out and turn the raw file
+ *    into the trace
+ */
+static void __attribute__((destructor)) rec_finish(void)
+{
+    struct stat st;
+    recbuf_t *b;
+    rec_t *raw;
+    uint64_t num_seqs;
+
+    if (!recording)
+	return;
+    __atomic_store_n(&recording, 0, __ATOMIC_RELAXED);
+    num_seqs = __atomic_load_n(&recSeq, __ATOMIC_RELAXED);
+    for (b = recBufs; b; b = b->next)
+	rec_flush(b);
+
+    if (fstat(recFd, &st) < 0) {
+	shim_error("can't stat the raw trace");
+	return;
+    }
+    raw = mmap(NULL, st.st_size + 1, PROT_READ, MAP_PRIVATE, recFd, 0);
+    if (raw == MAP_FAILED ||
+	write_trace(raw, st.st_size / sizeof(rec_t), num_seqs) < 0) {
+	shim_error("can't write the trace, the raw trace is left behind");
+	return;
+    }
+    munmap(raw, st.st_size + 1);
+    close(recFd);
+    unlink(rawPath);
+}
@@ -0,0 +1,764 @@
+/*
+ * trace.c - Reading and writing the driver's trace files (see trace.h)
+ *
+ * A streamed binary trace is mapped like any other, but we tell the
+ * kernel to read ahead of the chunk being replayed and to drop the
+ * pages behind it, so only a few chunks are ever resident. A streamed
+ * text trace is parsed by a reader thread into one of two buffers while
+ * the replay works through the other.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+#define LIVE_MIN 1024 /* slots in a new block hash table */
+
+extern int verbose; /* -v option of the program reading the trace */
+
+/* Where the text parser is in a trace */
+typedef struct {
+    char *path;          /* the trace file, for error messages */
+    unsigned tid;        /* thread that makes the next requests */
+    int *seqs;           /* requests made on each block so far */
+    int num_ids;         /* ids the header promised */
+    int num_threads;     /* threads seen so far */
+    unsigned max_index;  /* highest id seen so far */
+    int64_t parsed;      /* requests parsed so far */
+} parse_t;
+
+/* How a streamed trace is read */
+struct stream {
+    char path[MAXLINE];
+    int binary;              /* binary trace, or text? */
+
+    /* Binary traces */
+    traceop_t *ops;          /* every op, in the mapping */
+    size_t dropped;          /* pages of the mapping we let go of, in bytes */
+    int64_t checked;         /* ops whose checksum we have taken */
+    uint64_t sum;            /* their checksum so far */
+    uint64_t want;           /* the checksum the header promised */
+
+    /* Text traces */
+    FILE *file;
+    parse_t ps;
+    pthread_t reader;        /* the thread parsing the file */
+    int running;             /* is there one? */
+    pthread_mutex_t lock;    /* protects count[] and stop */
+    pthread_cond_t cond;     /* signalled whenever one of them changes */
+    traceop_t *buf[2];       /* the reader fills one while we replay the other */
+    int count[2];            /* ops in each buffer, -1 while it is free */
+    int cur;                 /* buffer we are replaying, -1 before the first */
+    int stop;                /* tells the reader to quit */
+    int done;                /* has the reader reached the end? */
+};
+
+/*
+ * trace_error - Report an error reading a trace, Unix-style if err
+ *    is nonzero
+ */
+static void trace_error(char *path, char *msg, int err)
+{
+    if (err)
+	printf("%s: %s: %s\n", path, msg, strerror(err));
+    else
+	printf("%s: %s\n", path, msg);
+    exit(1);
+}
+
+/*
+ * trace_checksum - FNV-1a over the 8-byte words of the len bytes at
+ *    p, starting from hash h. Taking a word at a time instead of a byte
+ *    is still more than enough to catch corruption, and keeps checking
+ *    a trace of millions of ops well under the time it takes to read it.
+ */
+static uint64_t trace_checksum(uint64_t h, const void *p, size_t len)
+{
+    const uint64_t *w = (const uint64_t *)p;
+    size_t i;
+
+    assert(len % sizeof(uint64_t) == 0);
+    for (i = 0; i < len / sizeof(uint64_t); i++)
+	h = (h ^ w[i]) * FNV_PRIME;
+    return h;
+}
+
+/*
+ * check_ops - The checksum says the ops are what the writer wrote; the
+ *    driver indexes arrays with them, so make sure that was sane too
+ */
+static void check_ops(trace_t *trace, char *path, traceop_t *op, int n)
+{
+    for (; n > 0; n--, op++)
+	if (op->type >= NUM_TYPES || op->index < 0 ||
+	    op->index >= trace->num_ids || op->tid >= trace->num_threads ||
+	    (op->type != FREE && op->size < 0) ||
+	    op->align > TRACE_MAX_ALIGN)
+	    trace_error(path, "Bad request in trace", 0);
+}
+
+/*
+ * alloc_blocks - Allocate the arrays the driver keeps its blocks in, or
+ *    for a streamed trace the hash table of the blocks that are live
+ */
+static void alloc_blocks(trace_t *trace, char *path)
+{
+    size_t i;
+
+    if (trace->stream) {
+	trace->live_mask = LIVE_MIN - 1;
+	if ((trace->live = (live_t *)malloc(LIVE_MIN * sizeof(live_t))) == NULL)
+	    trace_error(path, "malloc 3 failed in read_trace", errno);
+	for (i = 0; i < LIVE_MIN; i++)
+	    trace->live[i].index = -1;
+	return;
+    }
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	trace_error(path, "malloc 3 failed in read_trace", errno);
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	trace_error(path, "malloc 4 failed in read_trace", errno);
+}
+
+/*
+ * read_text_header - Read the four numbers a .rep file starts with
+ */
+static void read_text_header(trace_t *trace, FILE *tracefile, char *path)
+{
+    long long num_ops;
+
+    if (fscanf(tracefile, "%d %d %lld %d", &trace->sugg_heapsize,
+	       &trace->num_ids, &num_ops, &trace->weight) != 4 ||
+	trace->num_ids <= 0 || num_ops < 0)
+	trace_error(path, "Bad trace header", 0);
+    trace->num_ops = num_ops;
+}
+
+/*
+ * parse_ops - Parse up to max requests of a .rep file into ops, and
+ *    return how many there were (fewer only at the end of the file)
+ *
+ * Besides the a/f/r requests a trace can contain "m <id> <size> <align>"
+ * requests, which malloc a block whose payload is aligned to align (a
+ * power of 2) bytes, and "t <tid>" lines, which say that the requests
+ * after them are made by thread tid (0 until the first one). A block can
+ * be malloced by one thread and freed by another.
+ */
+static int parse_ops(FILE *tracefile, traceop_t *ops, int max, parse_t *ps)
+{
+    char type[MAXLINE];
+    unsigned index, size, align;
+    int n = 0;
+
+    index = 0;
+    while (n < max && fscanf(tracefile, "%s", type) != EOF) {
+	if (type[0] == 't') {
+	    /* Not a request: the requests that follow are made by thread tid */
+	    fscanf(tracefile, "%u", &ps->tid);
+	    if (ps->tid >= TRACE_MAX_THREADS)
+		trace_error(ps->path, "Too many threads", 0);
+	    if (ps->tid >= ps->num_threads)
+		ps->num_threads = ps->tid + 1;
+	    continue;
+	}
+	memset(&ops[n], 0, sizeof(traceop_t));
+	switch(type[0]) {
+	case 'a':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    ops[n].type = ALLOC;
+	    ops[n].index = index;
+	    ops[n].size = size;
+	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    ops[n].type = CALLOC;
+	    ops[n].index = index;
+	    ops[n].size = size;
+	    break;
+	case 'r':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    ops[n].type = REALLOC;
+	    ops[n].index = index;
+	    ops[n].size = size;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &size, &align);
+	    if (align == 0 || (align & (align - 1)) != 0 ||
+		align > 1U << TRACE_MAX_ALIGN)
+		trace_error(ps->path, "Bad alignment in trace", 0);
+	    ops[n].type = MEMALIGN;
+	    ops[n].index = index;
+	    ops[n].size = size;
+	    ops[n].align = __builtin_ctz(align);
+	    break;
+	case 'f':
+	    fscanf(tracefile, "%ud", &index);
+	    ops[n].type = FREE;
+	    ops[n].index = index;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n",
+		   type[0], ps->path);
+	    exit(1);
+	}
+	if (index >= ps->num_ids)
+	    trace_error(ps->path, "Request on an id beyond num_ids", 0);
+	if (ops[n].type != FREE)
+	    ps->max_index = (index > ps->max_index) ? index : ps->max_index;
+	ops[n].tid = ps->tid;
+	ops[n].seq = ps->seqs[index]++;
+	n++;
+    }
+    ps->parsed += n;
+    return n;
+}
+
+/*
+ * parse_start - Get ps ready to parse the requests of trace
+ */
+static void parse_start(parse_t *ps, trace_t *trace, char *path)
+{
+    if (ps->seqs == NULL &&
+	(ps->seqs = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	trace_error(path, "malloc 5 failed in read_trace", errno);
+    memset(ps->seqs, 0, trace->num_ids * sizeof(int));
+    ps->path = path;
+    ps->tid = 0;
+    ps->num_ids = trace->num_ids;
+    ps->num_threads = 1;
+    ps->max_index = 0;
+    ps->parsed = 0;
+}
+
+/*
+ * parse_end - Check that the trace had as many requests and ids as its
+ *    header said
+ */
+static void parse_end(parse_t *ps, trace_t *trace)
+{
+    if (ps->parsed != trace->num_ops || ps->max_index != trace->num_ids - 1)
+	trace_error(ps->path, "Trace doesn't match its header", 0);
+    trace->num_threads = ps->num_threads;
+}
+
+/*
+ * read_text_trace - Parse a whole .rep trace file
+ */
+static void read_text_trace(trace_t *trace, char *path, FILE *tracefile)
+{
+    parse_t ps;
+    traceop_t extra;
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops =
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	trace_error(path, "malloc 2 failed in read_trace", errno);
+    alloc_blocks(trace, path);
+
+    /* read every request line in the trace file (there should be no
+       more than the header says, so we try for one extra) */
+    ps.seqs = NULL;
+    parse_start(&ps, trace, path);
+    parse_ops(tracefile, trace->ops, trace->num_ops, &ps);
+    parse_ops(tracefile, &extra, 1, &ps);
+    parse_end(&ps, trace);
+    free(ps.seqs);
+}
+
+/*
+ * text_reader - The reader thread of a streamed text trace: parse the
+ *    file a chunk at a time into whichever buffer the replay isn't
+ *    using. An empty chunk marks the end of the trace.
+ */
+static void *text_reader(void *ptr)
+{
+    trace_t *trace = (trace_t *)ptr;
+    struct stream *s = trace->stream;
+    int b = 0, n, stop;
+
+    do {
+	pthread_mutex_lock(&s->lock);
+	while (s->count[b] >= 0 && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	stop = s->stop;
+	pthread_mutex_unlock(&s->lock);
+	if (stop)
+	    break;
+
+	n = parse_ops(s->file, s->buf[b], TRACE_CHUNK, &s->ps);
+	if (n == 0)
+	    parse_end(&s->ps, trace);
+
+	pthread_mutex_lock(&s->lock);
+	s->count[b] = n;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	b ^= 1;
+    } while (n > 0);
+    return NULL;
+}
+
+/*
+ * open_stream - Set up the streaming of the trace in path, whose header
+ *    we have read. A binary trace has been mapped already.
+ */
+static void open_stream(trace_t *trace, char *path, FILE *tracefile)
+{
+    struct stream *s;
+
+    if ((s = (struct stream *)calloc(1, sizeof(struct stream))) == NULL)
+	trace_error(path, "malloc 2 failed in read_trace", errno);
+    trace->stream = s;
+    strcpy(s->path, path);
+    if (trace->map) {
+	s->binary = 1;
+	s->ops = trace->ops;
+	trace->ops = NULL;
+	s->sum = FNV_OFFSET;
+    } else {
+	s->file = tracefile;
+	if ((s->buf[0] = (traceop_t *)
+	     malloc(2 * TRACE_CHUNK * sizeof(traceop_t))) == NULL)
+	    trace_error(path, "malloc 2 failed in read_trace", errno);
+	s->buf[1] = s->buf[0] + TRACE_CHUNK;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+    }
+    alloc_blocks(trace, path);
+}
+
+/*
+ * stop_reader - Make the reader thread of a text trace quit
+ */
+static void stop_reader(struct stream *s)
+{
+    if (!s->running)
+	return;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->reader, NULL);
+    s->running = 0;
+}
+
+/*
+ * map_bin_trace - Map the binary trace file open on fd and check its
+ *    header, so a bad file is rejected up front instead of taking the
+ *    allocator down halfway through a replay. Returns the header.
+ */
+static trace_hdr_t map_bin_trace(trace_t *trace, char *path, int fd)
+{
+    struct stat st;
+    trace_hdr_t hdr;
+
+    if (fstat(fd, &st) < 0)
+	trace_error(path, "fstat failed in read_trace", errno);
+    if ((size_t)st.st_size < sizeof(trace_hdr_t))
+	trace_error(path, "Truncated trace header", 0);
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+	trace_error(path, "mmap failed in read_trace", errno);
+    madvise(trace->map, trace->map_size, MADV_SEQUENTIAL);
+
+    memcpy(&hdr, trace->map, sizeof(hdr));
+    if (hdr.byte_order != TRACE_BYTE_ORDER)
+	trace_error(path, "Trace was written on a machine of the other "
+		    "byte order", 0);
+    if (hdr.version != TRACE_VERSION)
+	trace_error(path, "Unknown trace version", 0);
+    if (hdr.num_ids <= 0 || hdr.num_ops < 0 || hdr.num_threads <= 0 ||
+	hdr.num_threads > TRACE_MAX_THREADS ||
+	(trace->map_size - sizeof(hdr)) / sizeof(traceop_t) != hdr.num_ops ||
+	(trace->map_size - sizeof(hdr)) % sizeof(traceop_t) != 0)
+	trace_error(path, "Trace header doesn't match its length", 0);
+
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+    trace->num_threads = hdr.num_threads;
+    trace->ops = (traceop_t *)((char *)trace->map + sizeof(hdr));
+    return hdr;
+}
+
+/*
+ * read_bin_trace - Check the whole of a mapped binary trace
+ */
+static void read_bin_trace(trace_t *trace, char *path, trace_hdr_t hdr)
+{
+    uint64_t sum = hdr.checksum;
+
+    hdr.checksum = 0;
+    if (trace_checksum(trace_checksum(FNV_OFFSET, trace->ops,
+				      trace->num_ops * sizeof(traceop_t)),
+		       &hdr, sizeof(hdr)) != sum)
+	trace_error(path, "Bad checksum, trace is corrupted", 0);
+    check_ops(trace, path, trace->ops, trace->num_ops);
+    alloc_blocks(trace, path);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory, or get it
+ *    ready to be streamed. A binary trace (one that starts with
+ *    TRACE_MAGIC) is mapped, a text one parsed.
+ */
+trace_t *read_trace(char *tracedir, char *filename, int stream)
+{
+    trace_t *trace;
+    FILE *tracefile;
+    trace_hdr_t hdr;
+    char path[MAXLINE];
+    char magic[sizeof(TRACE_MAGIC) - 1];
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+	trace_error(filename, "malloc 1 failed in read_trace", errno);
+
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL)
+	trace_error(path, "Could not open in read_trace", errno);
+
+    if (fread(magic, sizeof(magic), 1, tracefile) == 1 &&
+	memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+	hdr = map_bin_trace(trace, path, fileno(tracefile));
+	fclose(tracefile);
+	if (stream || trace->num_ops > TRACE_MEM_OPS) {
+	    open_stream(trace, path, NULL);
+	    trace->stream->want = hdr.checksum;
+	} else
+	    read_bin_trace(trace, path, hdr);
+    } else {
+	rewind(tracefile);
+	read_text_header(trace, tracefile, path);
+	trace->num_threads = 1;
+	if (stream || trace->num_ops > TRACE_MEM_OPS)
+	    open_stream(trace, path, tracefile);
+	else {
+	    read_text_trace(trace, path, tracefile);
+	    fclose(tracefile);
+	}
+    }
+    trace_rewind(trace);
+    return trace;
+}
+
+/*
+ * next_bin_chunk - Hand out the next chunk of a streamed binary trace.
+ *    The first time through we check the ops as we go, and the checksum
+ *    when we get to the end; we let go of the pages we are done with
+ *    and have the kernel read the ones after this chunk in.
+ */
+static int next_bin_chunk(trace_t *trace, traceop_t **ops)
+{
+    struct stream *s = trace->stream;
+    size_t page = getpagesize();
+    size_t off, ahead;
+    trace_hdr_t hdr;
+    int n;
+
+    if (trace->next >= trace->num_ops)
+	return 0;
+    n = trace->num_ops - trace->next < TRACE_CHUNK ?
+	trace->num_ops - trace->next : TRACE_CHUNK;
+    *ops = s->ops + trace->next;
+
+    if (trace->next == s->checked) {
+	check_ops(trace, s->path, *ops, n);
+	s->sum = trace_checksum(s->sum, *ops, n * sizeof(traceop_t));
+	s->checked += n;
+	if (s->checked == trace->num_ops) {
+	    memcpy(&hdr, trace->map, sizeof(hdr));
+	    hdr.checksum = 0;
+	    if (trace_checksum(s->sum, &hdr, sizeof(hdr)) != s->want)
+		trace_error(s->path, "Bad checksum, trace is corrupted", 0);
+	}
+    }
+
+    off = ((char *)*ops - (char *)trace->map) / page * page;
+    if (off > s->dropped) {
+	madvise((char *)trace->map + s->dropped, off - s->dropped,
+		MADV_DONTNEED);
+	s->dropped = off;
+    }
+    ahead = (char *)(*ops + n) - (char *)trace->map;
+    if (ahead < trace->map_size)
+	madvise((char *)trace->map + ahead / page * page,
+		trace->map_size - ahead < TRACE_CHUNK * sizeof(traceop_t) ?
+		trace->map_size - ahead : TRACE_CHUNK * sizeof(traceop_t),
+		MADV_WILLNEED);
+    return n;
+}
+
+/*
+ * next_text_chunk - Give the buffer we were replaying back to the
+ *    reader thread, and wait for it to fill the other one
+ */
+static int next_text_chunk(trace_t *trace, traceop_t **ops)
+{
+    struct stream *s = trace->stream;
+    int n;
+
+    if (s->done)
+	return 0;
+    pthread_mutex_lock(&s->lock);
+    if (s->cur >= 0) {
+	s->count[s->cur] = -1;
+	pthread_cond_broadcast(&s->cond);
+    }
+    s->cur = (s->cur + 1) & 1;
+    while (s->count[s->cur] < 0)
+	pthread_cond_wait(&s->cond, &s->lock);
+    n = s->count[s->cur];
+    pthread_mutex_unlock(&s->lock);
+
+    *ops = s->buf[s->cur];
+    if (n == 0)
+	s->done = 1;
+    return n;
+}
+
+/*
+ * trace_next - Set *ops to the next requests of trace and return how
+ *    many there are, 0 at the end of the trace. A trace in memory comes
+ *    in one chunk.
+ */
+int trace_next(trace_t *trace, traceop_t **ops)
+{
+    int n;
+
+    if (trace->stream == NULL) {
+	if (trace->next >= trace->num_ops)
+	    return 0;
+	*ops = trace->ops;
+	n = trace->num_ops;
+    } else if (trace->stream->binary)
+	n = next_bin_chunk(trace, ops);
+    else
+	n = next_text_chunk(trace, ops);
+    trace->next += n;
+    return n;
+}
+
+/*
+ * trace_rewind - Start trace over from its first request, forgetting
+ *    every block. A text trace is read again from the top.
+ */
+void trace_rewind(trace_t *trace)
+{
+    struct stream *s = trace->stream;
+    char line[MAXLINE];
+    size_t i;
+
+    trace->next = 0;
+    if (trace->live) {
+	for (i = 0; i <= trace->live_mask; i++)
+	    trace->live[i].index = -1;
+	trace->num_live = 0;
+    }
+    if (s == NULL)
+	return;
+    if (s->binary) {
+	s->dropped = 0;
+	return;
+    }
+
+    /* Start a new reader after the header */
+    stop_reader(s);
+    rewind(s->file);
+    for (i = 0; i < 4; i++)
+	fscanf(s->file, "%s", line);
+    parse_start(&s->ps, trace, s->path);
+    s->count[0] = s->count[1] = -1;
+    s->cur = -1;
+    s->stop = 0;
+    s->done = 0;
+    if ((errno = pthread_create(&s->reader, NULL, text_reader, trace)) != 0)
+	trace_error(s->path, "pthread_create failed in trace_rewind", errno);
+    s->running = 1;
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points to, all
+ *              of which were allocated (or mapped) in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    struct stream *s = trace->stream;
+
+    if (s) {
+	if (!s->binary) {
+	    stop_reader(s);
+	    fclose(s->file);
+	    free(s->buf[0]);
+	    free(s->ps.seqs);
+	    pthread_mutex_destroy(&s->lock);
+	    pthread_cond_destroy(&s->cond);
+	}
+	free(s);
+    }
+    if (trace->map)
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
+    free(trace->blocks);
+    free(trace->block_sizes);
+    free(trace->live);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * write_trace_bin - Write trace to path in the binary format. The ops
+ *    go out a chunk at a time, and the header (with the checksum, and
+ *    the thread count of a streamed text trace) once we have seen them
+ *    all. This leaves trace at its end.
+ */
+int write_trace_bin(trace_t *trace, char *path)
+{
+    trace_hdr_t hdr;
+    FILE *f;
+    traceop_t *ops;
+    uint64_t sum = FNV_OFFSET;
+    int n;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if ((f = fopen(path, "wb")) == NULL)
+	return -1;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+	goto fail;
+    trace_rewind(trace);
+    while ((n = trace_next(trace, &ops)) > 0) {
+	if (fwrite(ops, sizeof(traceop_t), n, f) != n)
+	    goto fail;
+	sum = trace_checksum(sum, ops, n * sizeof(traceop_t));
+    }
+
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.byte_order = TRACE_BYTE_ORDER;
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    hdr.num_threads = trace->num_threads;
+    hdr.checksum = trace_checksum(sum, &hdr, sizeof(hdr));
+    rewind(f);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+	goto fail;
+    return fclose(f);
+
+ fail:
+    fclose(f);
+    return -1;
+}
+
+/*
+ * live_hash - Slot where the hash table of trace would like block index
+ */
+static size_t live_hash(trace_t *trace, int index)
+{
+    uint32_t x = (uint32_t)index;
+
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    return ((x >> 16) ^ x) & trace->live_mask;
+}
+
+/*
+ * live_grow - Double the hash table of trace
+ */
+static void live_grow(trace_t *trace)
+{
+    live_t *old = trace->live;
+    size_t i, j, size = trace->live_mask + 1;
+
+    if ((trace->live = (live_t *)malloc(2 * size * sizeof(live_t))) == NULL)
+	trace_error(trace->stream->path, "malloc failed in live_grow", errno);
+    trace->live_mask = 2 * size - 1;
+    for (i = 0; i < 2 * size; i++)
+	trace->live[i].index = -1;
+    for (i = 0; i < size; i++) {
+	if (old[i].index < 0)
+	    continue;
+	for (j = live_hash(trace, old[i].index); trace->live[j].index >= 0;
+	     j = (j + 1) & trace->live_mask)
+	    ;
+	trace->live[j] = old[i];
+    }
+    free(old);
+}
+
+/*
+ * trace_live - Find block index in the hash table of trace, with linear
+ *    probing. If it isn't there, return NULL, or with insert add it.
+ *    The table is kept at most half full.
+ */
+live_t *trace_live(trace_t *trace, int index, int insert)
+{
+    size_t i;
+
+    if (insert && 2 * (trace->num_live + 1) > trace->live_mask + 1)
+	live_grow(trace);
+    for (i = live_hash(trace, index); trace->live[i].index >= 0;
+	 i = (i + 1) & trace->live_mask)
+	if (trace->live[i].index == index)
+	    return &trace->live[i];
+    if (!insert)
+	return NULL;
+    trace->live[i].index = index;
+    trace->num_live++;
+    return &trace->live[i];
+}
+
+/*
+ * trace_live_drop - Take block index out of the hash table of trace.
+ *    Rather than leave a tombstone, we move every later block of the
+ *    same run that would rather be in the hole (or before it) back into
+ *    it, so lookups never have to probe past deleted blocks.
+ */
+void trace_live_drop(trace_t *trace, int index)
+{
+    live_t *live = trace->live;
+    size_t mask = trace->live_mask;
+    size_t i, j, k;
+
+    for (i = live_hash(trace, index); live[i].index != index;
+	 i = (i + 1) & mask)
+	if (live[i].index < 0)
+	    return;
+    trace->num_live--;
+    for (j = i; ; ) {
+	j = (j + 1) & mask;
+	if (live[j].index < 0)
+	    break;
+	k = live_hash(trace, live[j].index);
+	/* Leave j where it is if its home k is cyclically in (i, j] */
+	if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+	    continue;
+	live[i] = live[j];
+	i = j;
+    }
+    live[i].index = -1;
+}
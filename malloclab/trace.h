@@ -0,0 +1,151 @@
+/*
+ * trace.h - Reading and writing the driver's trace files
+ *
+ * A trace comes either as text (the .rep files: a four line header
+ * followed by one request per line) or in the binary format below,
+ * which is just the header and the traceop_t array as they sit in
+ * memory. A binary trace is mmap'ed and replayed straight out of the
+ * page cache, so nothing is parsed or copied however long it is.
+ *
+ * A trace too long to hold in memory (or any trace, if asked) is
+ * streamed instead: its requests are handed out TRACE_CHUNK at a time
+ * by trace_next, and only the blocks that are currently allocated are
+ * remembered, in a hash table rather than arrays of num_ids entries.
+ * Replays should use trace_next and the trace_*block functions, which
+ * work either way.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC, MEMALIGN, CALLOC, NUM_TYPES};
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    uint8_t type;         /* type of request */
+    uint8_t align;        /* log2 of a MEMALIGN request's alignment */
+    uint16_t tid;         /* thread that makes the request */
+    int32_t index;        /* index for free() to use later */
+    int32_t size;         /* byte size of alloc/realloc/calloc request */
+    int32_t seq;          /* number of earlier requests on index */
+} traceop_t;
+
+#define TRACE_MAX_THREADS 65536   /* tids have to fit in traceop_t.tid */
+#define TRACE_CHUNK       (1<<16) /* requests trace_next hands out at once */
+#define TRACE_MEM_OPS     (1<<26) /* longer traces are always streamed */
+#define TRACE_MAX_ALIGN   30      /* largest log2 alignment a request can ask for */
+
+/* A block the driver allocated, in the hash table of a streamed trace */
+typedef struct {
+    int32_t index;       /* id of the block, -1 if the slot is empty */
+    size_t size;         /* its payload size */
+    char *p;             /* and where the allocator put it */
+} live_t;
+
+struct stream;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int64_t num_ops;     /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    int num_threads;     /* number of threads making requests */
+    traceop_t *ops;      /* array of requests (NULL if streamed) */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file (ops point into it) */
+    size_t map_size;     /* its length in bytes */
+    int64_t next;        /* requests trace_next has handed out */
+    struct stream *stream; /* how a streamed trace is read, else NULL */
+    live_t *live;        /* the blocks of a streamed trace... */
+    size_t live_mask;    /* ...in a table of live_mask+1 slots */
+    size_t num_live;     /* of which this many are in use */
+} trace_t;
+
+/*
+ * Header of a binary trace file. The ops follow it directly. The
+ * checksum covers every op and then the header (with checksum 0), and
+ * byte_order lets us tell a file written on a machine of the other
+ * endianness from a corrupted one.
+ */
+#define TRACE_MAGIC      "MMTRACE\n"
+#define TRACE_VERSION    2
+#define TRACE_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[8];         /* TRACE_MAGIC */
+    uint32_t version;      /* TRACE_VERSION */
+    uint32_t byte_order;   /* TRACE_BYTE_ORDER as the writer stored it */
+    int32_t sugg_heapsize; /* the trace_t fields of the same names */
+    int32_t num_ids;
+    int32_t weight;
+    int32_t num_threads;
+    int64_t num_ops;
+    uint64_t checksum;     /* trace_checksum of ops and header */
+} trace_hdr_t;
+
+/* Read trace file tracedir/filename, text or binary, whole if we can
+   and stream is 0. Exits on any error */
+trace_t *read_trace(char *tracedir, char *filename, int stream);
+
+/* Free a trace returned by read_trace */
+void free_trace(trace_t *trace);
+
+/* Set *ops to the next requests of trace and return how many there
+   are, 0 at the end of the trace */
+int trace_next(trace_t *trace, traceop_t **ops);
+
+/* Start trace over from its first request, forgetting every block */
+void trace_rewind(trace_t *trace);
+
+/* Write trace to path in the binary format, streaming it if it is
+   streamed. Returns 0, or -1 with errno set */
+int write_trace_bin(trace_t *trace, char *path);
+
+/* Blocks of streamed traces live in the hash table */
+live_t *trace_live(trace_t *trace, int index, int insert);
+void trace_live_drop(trace_t *trace, int index);
+
+/* Return block index of trace (and its size in *size, if not NULL) */
+static inline char *trace_block(trace_t *trace, int index, size_t *size)
+{
+    live_t *b;
+
+    if (trace->live == NULL) {
+	if (size)
+	    *size = trace->block_sizes[index];
+	return trace->blocks[index];
+    }
+    if ((b = trace_live(trace, index, 0)) == NULL) {
+	if (size)
+	    *size = 0;
+	return NULL;
+    }
+    if (size)
+	*size = b->size;
+    return b->p;
+}
+
+/* Remember that block index of trace is p, of size bytes */
+static inline void trace_set_block(trace_t *trace, int index, char *p,
+				   size_t size)
+{
+    live_t *b;
+
+    if (trace->live == NULL) {
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
+    } else {
+	b = trace_live(trace, index, 1);
+	b->p = p;
+	b->size = size;
+    }
+}
+
+/* Forget block index of trace, which has been freed */
+static inline void trace_drop_block(trace_t *trace, int index)
+{
+    if (trace->live)
+	trace_live_drop(trace, index);
+}
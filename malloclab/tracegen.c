@@ -0,0 +1,485 @@
+/*
+ * tracegen.c - Generate synthetic .rep traces from simple workload models
+ *
+ * A trace is generated one request at a time. While fewer than the
+ * target number of blocks are live we lean towards mallocs, above it
+ * towards frees, so the live set hovers around the target; a fraction
+ * of the requests are reallocs that keep growing one block at a time;
+ * and the last requests free whatever is still live, so every trace is
+ * balanced. Ids of freed blocks are handed out again, which keeps
+ * num_ids (and what the driver needs to replay the trace) about the
+ * size of the live set however long the trace is.
+ *
+ * The random numbers come from our own generator, so a seed gives the
+ * same trace on any machine.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+
+#define MAXSIZE (1<<24)  /* no request is bigger than this */
+#define MAXCLASSES 64    /* sizes a "classes" model can pick from */
+#define HDRWIDTH 20      /* header numbers are padded to this width */
+
+/* Size distributions */
+enum {SZ_CLASSES, SZ_POWERLAW, SZ_BIMODAL, SZ_UNIFORM};
+
+/* Lifetime models: which live block the next free is for */
+enum {LT_LIFO, LT_FIFO, LT_RANDOM, LT_LONG};
+
+/* Realloc growth patterns */
+enum {RE_NONE, RE_VECTOR, RE_APPEND};
+
+/* The whole model */
+typedef struct {
+    int size_model;
+    double size_arg[3];            /* model parameters, see usage() */
+    int classes[MAXCLASSES];       /* the sizes of SZ_CLASSES */
+    int num_classes;
+    int lifetime;
+    double long_frac;              /* fraction of blocks that live forever */
+    int realloc_model;
+    double realloc_frac;           /* fraction of requests that are reallocs */
+    double align_frac;             /* fraction of mallocs that are memaligns... */
+    int align;                     /* ...to this many bytes */
+    double calloc_frac;            /* fraction of mallocs that are callocs */
+    long long ops;                 /* requests in the trace */
+    long target;                   /* live blocks to aim for */
+} model_t;
+
+/* The blocks that are live, in the order they were malloc'ed */
+typedef struct {
+    int *id;         /* ring buffer of ids... */
+    int *size;       /* ...and their sizes */
+    long cap;        /* slots in the ring (a power of 2) */
+    long head;       /* oldest live block */
+    long n;          /* live blocks */
+} live_t;
+
+static unsigned long long rng_state;
+
+/*
+ * rng - xorshift64*, uniformly distributed 64-bit numbers
+ */
+static unsigned long long rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+/* A uniform double in (0,1], and a uniform long in [0,n) */
+static double rng_unit(void)
+{
+    return ((rng() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static long rng_below(long n)
+{
+    return (long)(rng() % (unsigned long long)n);
+}
+
+/*
+ * next_size - Draw a request size from the size model
+ */
+static int next_size(model_t *m)
+{
+    double s;
+
+    switch (m->size_model) {
+    case SZ_CLASSES:
+	return m->classes[rng_below(m->num_classes)];
+    case SZ_POWERLAW:  /* Pareto with exponent arg[0] from arg[1], cut at arg[2] */
+	s = m->size_arg[1] / pow(rng_unit(), 1.0 / m->size_arg[0]);
+	if (s > m->size_arg[2])
+	    s = m->size_arg[2];
+	break;
+    case SZ_BIMODAL:   /* arg[0] or, with probability arg[2], arg[1], +-25% */
+	s = rng_unit() <= m->size_arg[2] ? m->size_arg[1] : m->size_arg[0];
+	s *= 0.75 + 0.5 * rng_unit();
+	break;
+    default:           /* anything from arg[0] to arg[1] */
+	s = m->size_arg[0] + rng_below((long)(m->size_arg[1] - m->size_arg[0]) + 1);
+	break;
+    }
+    return s < 1 ? 1 : (s > MAXSIZE ? MAXSIZE : (int)s);
+}
+
+/*
+ * live_push - Remember a new live block
+ */
+static void live_push(live_t *l, int id, int size)
+{
+    long i, j;
+
+    if (l->n == l->cap) {
+	l->id = realloc(l->id, 2 * l->cap * sizeof(int));
+	l->size = realloc(l->size, 2 * l->cap * sizeof(int));
+	if (l->id == NULL || l->size == NULL) {
+	    perror("tracegen: realloc");
+	    exit(1);
+	}
+	/* Unwrap the ring into the new room */
+	for (i = 0; i < l->head; i++) {
+	    j = l->cap + i;
+	    l->id[j] = l->id[i];
+	    l->size[j] = l->size[i];
+	}
+	l->cap *= 2;
+    }
+    i = (l->head + l->n++) & (l->cap - 1);
+    l->id[i] = id;
+    l->size[i] = size;
+}
+
+/*
+ * live_take - Forget the live block at position pos (0 is the oldest),
+ *    returning its id. Only the oldest and newest keep the order of the
+ *    rest; any other is replaced by the newest.
+ */
+static int live_take(live_t *l, long pos)
+{
+    long i = (l->head + pos) & (l->cap - 1);
+    long last = (l->head + l->n - 1) & (l->cap - 1);
+    int id = l->id[i];
+
+    if (pos == 0)
+	l->head = (l->head + 1) & (l->cap - 1);
+    else {
+	l->id[i] = l->id[last];
+	l->size[i] = l->size[last];
+    }
+    l->n--;
+    return id;
+}
+
+/*
+ * grow_ints - Make room for n ints at *p, which has room for *cap
+ */
+static void grow_ints(int **p, long *cap, long n)
+{
+    if (n <= *cap)
+	return;
+    *cap = *cap ? 2 * *cap : 1024;
+    if ((*p = realloc(*p, *cap * sizeof(int))) == NULL) {
+	perror("tracegen: realloc");
+	exit(1);
+    }
+}
+
+/*
+ * generate - Write a trace of model m to f
+ */
+static void generate(model_t *m, FILE *f)
+{
+    live_t live;                  /* blocks we may free */
+    live_t forever;               /* long-lived blocks, freed at the end */
+    int *free_ids = NULL;         /* ids we can hand out again */
+    long free_cap = 0, num_free = 0;
+    int num_ids = 0;
+    int id, size, grow = -1;      /* grow: the block reallocs grow, if any */
+    long pos, grow_pos = 0;
+    long long i, bytes = 0, max_bytes = 0;
+    live_t *l;
+
+    memset(&live, 0, sizeof(live));
+    memset(&forever, 0, sizeof(forever));
+    live.cap = forever.cap = 1024;
+    live.id = malloc(live.cap * sizeof(int));
+    live.size = malloc(live.cap * sizeof(int));
+    forever.id = malloc(forever.cap * sizeof(int));
+    forever.size = malloc(forever.cap * sizeof(int));
+    if (!live.id || !live.size || !forever.id || !forever.size) {
+	perror("tracegen: malloc");
+	exit(1);
+    }
+
+    /* Room for the header, which we write when we know what's in it */
+    fprintf(f, "%*s\n%*s\n%*s\n%*s\n", HDRWIDTH, "", HDRWIDTH, "",
+	    HDRWIDTH, "", HDRWIDTH, "");
+
+    for (i = 0; i < m->ops; i++) {
+	/* The last requests free every block that is still live */
+	if (m->ops - i <= live.n + forever.n) {
+	    l = live.n > 0 ? &live : &forever;
+	    pos = l->n - 1;
+	    goto do_free;
+	}
+
+	/*
+	 * With one request more than that to go, a malloc would leave a
+	 * block nobody frees, and a realloc is the only request that
+	 * doesn't change how many are live. So that one is a realloc of
+	 * the newest block to the size it already has. Mallocs and frees
+	 * come in pairs, so we need one whenever the other reallocs leave
+	 * an odd number of requests for them (without reallocs, whenever
+	 * -n is odd)
+	 */
+	if (m->ops - i == live.n + forever.n + 1) {
+	    l = live.n > 0 ? &live : &forever;
+	    pos = (l->head + l->n - 1) & (l->cap - 1);
+	    fprintf(f, "r %d %d\n", l->id[pos], l->size[pos]);
+	    continue;
+	}
+	l = &live;
+
+	/* Realloc: keep growing one block until it gets too big */
+	if (m->realloc_model != RE_NONE && live.n > 0 &&
+	    rng_unit() <= m->realloc_frac) {
+	    if (grow < 0 || grow_pos >= live.n ||
+		live.id[(live.head + grow_pos) & (live.cap - 1)] != grow) {
+		grow_pos = rng_below(live.n);
+		grow = live.id[(live.head + grow_pos) & (live.cap - 1)];
+	    }
+	    pos = (live.head + grow_pos) & (live.cap - 1);
+	    size = live.size[pos];
+	    if (m->realloc_model == RE_VECTOR)
+		size = size < 8 ? 16 : 2 * size;
+	    else
+		size += 1 + rng_below(64);
+	    if (size > MAXSIZE) {
+		pos = grow_pos; /* too big: free it, and grow another */
+		goto do_free;
+	    }
+	    fprintf(f, "r %d %d\n", grow, size);
+	    bytes += size - live.size[pos];
+	    live.size[pos] = size;
+	    if (bytes > max_bytes)
+		max_bytes = bytes;
+	    continue;
+	}
+
+	/* Lean towards malloc below the target live set, free above it */
+	if (live.n == 0 ||
+	    rng_unit() <= (live.n + forever.n < m->target ? 0.6 : 0.4)) {
+	    if (num_free > 0)
+		id = free_ids[--num_free];
+	    else {
+		id = num_ids++;
+		grow_ints(&free_ids, &free_cap, num_ids);
+	    }
+	    size = next_size(m);
+	    if (m->align_frac > 0 && rng_unit() <= m->align_frac)
+		fprintf(f, "m %d %d %d\n", id, size, m->align);
+	    else if (m->calloc_frac > 0 && rng_unit() <= m->calloc_frac)
+		fprintf(f, "c %d %d\n", id, size);
+	    else
+		fprintf(f, "a %d %d\n", id, size);
+	    if (m->lifetime == LT_LONG && rng_unit() <= m->long_frac)
+		live_push(&forever, id, size);
+	    else
+		live_push(&live, id, size);
+	    bytes += size;
+	    if (bytes > max_bytes)
+		max_bytes = bytes;
+	    continue;
+	}
+
+	/* Free, the block the lifetime model says */
+	if (m->lifetime == LT_LIFO)
+	    pos = live.n - 1;
+	else if (m->lifetime == LT_FIFO)
+	    pos = 0;
+	else
+	    pos = rng_below(live.n);
+
+    do_free:
+	bytes -= l->size[(l->head + pos) & (l->cap - 1)];
+	id = live_take(l, pos);
+	if (id == grow)
+	    grow = -1;
+	fprintf(f, "f %d\n", id);
+	free_ids[num_free++] = id;
+    }
+    if (live.n + forever.n != 0) {
+	fprintf(stderr, "tracegen: %ld blocks are never freed\n",
+		live.n + forever.n);
+	exit(1);
+    }
+
+    /* Now we know what goes in the header */
+    rewind(f);
+    fprintf(f, "%*lld\n%*d\n%*lld\n%*d\n", HDRWIDTH, max_bytes,
+	    HDRWIDTH, num_ids, HDRWIDTH, m->ops, HDRWIDTH, 1);
+    free(live.id);
+    free(live.size);
+    free(forever.id);
+    free(forever.size);
+    free(free_ids);
+}
+
+/*
+ * parse_args - Read up to max comma-separated numbers from s into v,
+ *    returning how many there were
+ */
+static int parse_args(char *s, double *v, int max)
+{
+    int n = 0;
+    char *end;
+
+    while (n < max && *s) {
+	v[n++] = strtod(s, &end);
+	if (end == s || (*end && *end != ','))
+	    return -1;
+	s = *end ? end + 1 : end;
+    }
+    return *s ? -1 : n;
+}
+
+/*
+ * parse_model - Set one part of model m from a "name:args" option,
+ *    given the names that part can take. Returns the index of the name,
+ *    and the args in v, or -1 if the option makes no sense.
+ */
+static int parse_model(char *opt, char **names, double *v, int max, int *nargs)
+{
+    int i;
+    size_t len = strcspn(opt, ":");
+
+    for (i = 0; names[i]; i++)
+	if (strlen(names[i]) == len && strncmp(opt, names[i], len) == 0)
+	    break;
+    if (names[i] == NULL)
+	return -1;
+    *nargs = opt[len] ? parse_args(opt + len + 1, v, max) : 0;
+    return *nargs < 0 ? -1 : i;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-h] [-n <ops>] [-L <live>] [-s <sizes>] "
+	    "[-l <lifetimes>] [-r <reallocs>]\n\t\t[-a <f>,<align>] [-c <f>] [-S <seed>] -o <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n <ops>     Requests in the trace (default 100000).\n");
+    fprintf(stderr, "\t-L <live>    Live blocks to aim for (default 1000).\n");
+    fprintf(stderr, "\t-s <sizes>   Request sizes, one of\n");
+    fprintf(stderr, "\t               classes:<s1>,<s2>,...  one of these sizes\n");
+    fprintf(stderr, "\t               powerlaw:<a>,<min>,<max>  Pareto with exponent a\n");
+    fprintf(stderr, "\t               bimodal:<small>,<large>,<p>  large with probability p\n");
+    fprintf(stderr, "\t               uniform:<min>,<max>\n");
+    fprintf(stderr, "\t             (default powerlaw:1.2,8,65536)\n");
+    fprintf(stderr, "\t-l <lifetimes> Which block is freed next, one of\n");
+    fprintf(stderr, "\t               lifo, fifo, random (default),\n");
+    fprintf(stderr, "\t               long:<f>  like random, but a fraction f of the\n");
+    fprintf(stderr, "\t               blocks live until the end of the trace\n");
+    fprintf(stderr, "\t-r <reallocs> Realloc growth, one of none (default),\n");
+    fprintf(stderr, "\t               vector:<f>  a fraction f of requests double a block\n");
+    fprintf(stderr, "\t               append:<f>  a fraction f of requests add 1-64 bytes\n");
+    fprintf(stderr, "\t-a <f>,<align> A fraction f of the mallocs are memaligns to\n");
+    fprintf(stderr, "\t             align bytes (default none).\n");
+    fprintf(stderr, "\t-c <f>       A fraction f of the mallocs are callocs (default none).\n");
+    fprintf(stderr, "\t-S <seed>    Seed of the random numbers (default 1).\n");
+    fprintf(stderr, "\t-o <file>    Write the trace to <file>.\n");
+}
+
+int main(int argc, char **argv)
+{
+    static char *sizes[] = {"classes", "powerlaw", "bimodal", "uniform", NULL};
+    static char *lifetimes[] = {"lifo", "fifo", "random", "long", NULL};
+    static char *reallocs[] = {"none", "vector", "append", NULL};
+    static int want[] = {-1, 3, 3, 2};   /* args each size model takes */
+    model_t m;
+    double v[MAXCLASSES];
+    char *outfile = NULL;
+    FILE *f;
+    int c, i, n;
+
+    memset(&m, 0, sizeof(m));
+    m.size_model = SZ_POWERLAW;
+    m.size_arg[0] = 1.2;
+    m.size_arg[1] = 8;
+    m.size_arg[2] = 65536;
+    m.lifetime = LT_RANDOM;
+    m.realloc_model = RE_NONE;
+    m.ops = 100000;
+    m.target = 1000;
+    rng_state = 1;
+
+    while ((c = getopt(argc, argv, "n:L:s:l:r:a:c:S:o:h")) != EOF) {
+	switch (c) {
+	case 'n':
+	    m.ops = (long long)strtod(optarg, NULL);
+	    break;
+	case 'L':
+	    m.target = (long)strtod(optarg, NULL);
+	    break;
+	case 's':
+	    m.size_model = parse_model(optarg, sizes, v, MAXCLASSES, &n);
+	    if (m.size_model < 0 || n == 0 ||
+		(want[m.size_model] > 0 && n != want[m.size_model])) {
+		usage();
+		exit(1);
+	    }
+	    if (m.size_model == SZ_CLASSES) {
+		for (i = 0; i < n; i++)
+		    m.classes[i] = (int)v[i];
+		m.num_classes = n;
+	    } else
+		memcpy(m.size_arg, v, n * sizeof(double));
+	    break;
+	case 'l':
+	    m.lifetime = parse_model(optarg, lifetimes, v, 1, &n);
+	    if (m.lifetime < 0 || n != (m.lifetime == LT_LONG)) {
+		usage();
+		exit(1);
+	    }
+	    m.long_frac = v[0];
+	    break;
+	case 'r':
+	    m.realloc_model = parse_model(optarg, reallocs, v, 1, &n);
+	    if (m.realloc_model < 0 || n != (m.realloc_model != RE_NONE)) {
+		usage();
+		exit(1);
+	    }
+	    m.realloc_frac = v[0];
+	    break;
+	case 'a':
+	    if (parse_args(optarg, v, 2) != 2 || v[1] < 1 ||
+		((long)v[1] & ((long)v[1] - 1)) != 0) {
+		usage();
+		exit(1);
+	    }
+	    m.align_frac = v[0];
+	    m.align = (int)v[1];
+	    break;
+	case 'c':
+	    m.calloc_frac = strtod(optarg, NULL);
+	    break;
+	case 'S':
+	    rng_state = strtoull(optarg, NULL, 0);
+	    if (rng_state == 0)  /* xorshift never leaves 0 */
+		rng_state = 1;
+	    break;
+	case 'o':
+	    outfile = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (outfile == NULL || m.ops < 2 || m.target < 1 ||
+	(m.size_model == SZ_POWERLAW && m.size_arg[0] <= 0)) {
+	usage();
+	exit(1);
+    }
+
+    /* The header goes in last, so the trace has to be a real file */
+    if ((f = fopen(outfile, "w")) == NULL) {
+	printf("%s: %s\n", outfile, strerror(errno));
+	exit(1);
+    }
+    generate(&m, f);
+    if (fclose(f) != 0) {
+	printf("%s: %s\n", outfile, strerror(errno));
+	exit(1);
+    }
+    exit(0);
+}